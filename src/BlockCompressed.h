@@ -0,0 +1,234 @@
+#ifndef BLOCKCOMPRESSED_H
+#define BLOCKCOMPRESSED_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <stdint.h>
+#include <zlib.h>
+
+/**
+ * Reader for BGZF block-compressed files (as written by `bgzip`)
+ *
+ * A BGZF file is a series of gzip members of at most 64 KB each; every
+ * member carries its own compressed size in a "BC" extra field. That makes
+ * the block index a cheap hop over headers, and every block inflates
+ * independently into a known slot of the output, so blocks can be
+ * decompressed in parallel.
+ */
+
+/**
+ * BgzfBlock - Location of one block in the compressed file and in the output
+ */
+struct BgzfBlock {
+    uint64_t dataOffset;      // Start of the raw deflate stream
+    uint32_t dataLength;      // Length of the raw deflate stream
+    uint32_t crc;             // CRC32 of the inflated bytes
+    uint64_t inflatedOffset;  // Where the inflated bytes go in the output
+    uint32_t inflatedSize;    // ISIZE from the block footer
+};
+
+namespace bgzf {
+
+inline uint16_t readLE16(const unsigned char* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline uint32_t readLE32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Fixed gzip header bytes that precede XLEN in every BGZF block
+const size_t HEADER_SIZE = 12;
+const size_t FOOTER_SIZE = 8;
+
+} // namespace bgzf
+
+/**
+ * Check whether a buffer starts with a BGZF block header
+ */
+inline bool isBgzf(const char* data, size_t size) {
+    using namespace bgzf;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    if (size < HEADER_SIZE + 6) return false;
+    if (p[0] != 31 || p[1] != 139 || p[2] != 8 || (p[3] & 4) == 0) return false;
+    uint16_t xlen = readLE16(p + 10);
+    if (size < HEADER_SIZE + xlen) return false;
+    for (size_t k = HEADER_SIZE; k + 4 <= HEADER_SIZE + xlen; ) {
+        uint16_t slen = readLE16(p + k + 2);
+        if (p[k] == 'B' && p[k + 1] == 'C' && slen == 2) return true;
+        k += 4 + slen;
+    }
+    return false;
+}
+
+/**
+ * Check whether a buffer starts with the gzip magic bytes
+ */
+inline bool isGzip(const char* data, size_t size) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    return size >= 2 && p[0] == 31 && p[1] == 139;
+}
+
+/**
+ * Inflate a plain gzip buffer (as written by `gzip`) in one pass
+ *
+ * Without a block index the stream cannot be split, so one thread inflates
+ * the whole file; concatenated members are inflated one after another.
+ * @param out Receives the inflated bytes
+ * @param outSize Receives their count
+ * @return false (with error set) on data that is not gzip or is corrupt
+ */
+inline bool inflateGzip(const char* data, size_t size,
+                        std::unique_ptr<char[]>& out, size_t& outSize, std::string& error)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 16 + 15) != Z_OK) {
+        error = "cannot initialise zlib";
+        return false;
+    }
+
+    size_t capacity = std::max<size_t>(size * 4, 1 << 16);
+    out.reset(new char[capacity]);
+    outSize = 0;
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    size_t consumed = 0;
+    bool ok = true;
+    for (;;) {
+        if (outSize == capacity) {
+            std::unique_ptr<char[]> grown(new char[capacity * 2]);
+            std::memcpy(grown.get(), out.get(), outSize);
+            out.swap(grown);
+            capacity *= 2;
+        }
+        // zlib counts in 32 bits; feed and drain at most 1 GB per call
+        zs.next_in = const_cast<Bytef*>(in + consumed);
+        zs.avail_in = (uInt)std::min<size_t>(size - consumed, 1u << 30);
+        zs.next_out = reinterpret_cast<Bytef*>(out.get() + outSize);
+        zs.avail_out = (uInt)std::min<size_t>(capacity - outSize, 1u << 30);
+        uInt availIn = zs.avail_in, availOut = zs.avail_out;
+        int rc = inflate(&zs, Z_NO_FLUSH);
+        consumed += availIn - zs.avail_in;
+        outSize += availOut - zs.avail_out;
+
+        if (rc == Z_STREAM_END) {
+            if (consumed == size) break;
+            inflateReset(&zs);
+        } else if (rc == Z_BUF_ERROR && consumed == size) {
+            error = "truncated gzip data";
+            ok = false;
+            break;
+        } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            error = "not gzip data or corrupt";
+            ok = false;
+            break;
+        }
+    }
+
+    inflateEnd(&zs);
+    return ok;
+}
+
+/**
+ * Build the block index of a BGZF buffer by hopping over block headers
+ * @param blocks Receives one entry per non-empty block, in file order
+ * @param inflatedTotal Receives the size of the whole inflated stream
+ * @return false (with error set) if the buffer is not well-formed BGZF
+ */
+inline bool indexBgzfBlocks(const char* data, size_t size,
+                            std::vector<BgzfBlock>& blocks, uint64_t& inflatedTotal,
+                            std::string& error)
+{
+    using namespace bgzf;
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(data);
+    uint64_t at = 0;
+    inflatedTotal = 0;
+
+    while (at < size) {
+        const unsigned char* p = base + at;
+        if (size - at < HEADER_SIZE || p[0] != 31 || p[1] != 139 || p[2] != 8 || (p[3] & 4) == 0) {
+            error = "bad BGZF block header";
+            return false;
+        }
+        uint16_t xlen = readLE16(p + 10);
+        if (size - at < HEADER_SIZE + xlen) {
+            error = "truncated BGZF block header";
+            return false;
+        }
+
+        int blockSize = -1;
+        for (size_t k = HEADER_SIZE; k + 4 <= HEADER_SIZE + xlen; ) {
+            uint16_t slen = readLE16(p + k + 2);
+            if (p[k] == 'B' && p[k + 1] == 'C' && slen == 2) {
+                blockSize = readLE16(p + k + 4) + 1;
+                break;
+            }
+            k += 4 + slen;
+        }
+        if (blockSize < 0 || (size_t)blockSize < HEADER_SIZE + xlen + FOOTER_SIZE ||
+            size - at < (uint64_t)blockSize) {
+            error = "missing or invalid BGZF block size";
+            return false;
+        }
+
+        BgzfBlock b;
+        b.dataOffset = at + HEADER_SIZE + xlen;
+        b.dataLength = (uint32_t)(blockSize - HEADER_SIZE - xlen - FOOTER_SIZE);
+        b.crc = readLE32(p + blockSize - 8);
+        b.inflatedSize = readLE32(p + blockSize - 4);
+        b.inflatedOffset = inflatedTotal;
+        if (b.inflatedSize > 0) {
+            blocks.push_back(b);
+            inflatedTotal += b.inflatedSize;
+        }
+        at += (uint64_t)blockSize;
+    }
+    return true;
+}
+
+/**
+ * Inflate a run of blocks into their slots of the output buffer
+ *
+ * Blocks touch disjoint parts of out, so different runs of the same file
+ * may be inflated concurrently.
+ * @return false (with error set) on corrupt data or CRC mismatch
+ */
+inline bool inflateBgzfBlocks(const char* data, const BgzfBlock* blocks, size_t count,
+                              char* out, std::string& error)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK) {
+        error = "cannot initialise zlib";
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t b = 0; b < count && ok; b++) {
+        const BgzfBlock& blk = blocks[b];
+        unsigned char* dest = reinterpret_cast<unsigned char*>(out + blk.inflatedOffset);
+
+        inflateReset(&zs);
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + blk.dataOffset));
+        zs.avail_in = blk.dataLength;
+        zs.next_out = dest;
+        zs.avail_out = blk.inflatedSize;
+
+        int rc = inflate(&zs, Z_FINISH);
+        if (rc != Z_STREAM_END || zs.avail_out != 0) {
+            error = "corrupt BGZF block";
+            ok = false;
+        } else if (crc32(crc32(0L, Z_NULL, 0), dest, blk.inflatedSize) != blk.crc) {
+            error = "BGZF block CRC mismatch";
+            ok = false;
+        }
+    }
+
+    inflateEnd(&zs);
+    return ok;
+}
+
+#endif // BLOCKCOMPRESSED_H
@@ -0,0 +1,226 @@
+#ifndef COMPONENTINDEX_H
+#define COMPONENTINDEX_H
+
+#include <set>
+#include <map>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+#include <ostream>
+#include <stdint.h>
+#include "GeneDictionary.h"
+#include "OrthologGraph.h"
+#include "FamilyIndex.h"
+#include "ThreadPool.h"
+
+/**
+ * ComponentLabeling - Events and ortholog groups of one labeled component
+ */
+struct ComponentLabeling {
+    std::set<GeneId> births;
+    std::set<GeneId> duplications;
+    std::map<int, int> losses;
+    std::string orthoGroups;
+
+    /**
+     * Add the labeling to a family's results
+     */
+    void replayInto(std::set<GeneId>& familyBirths, std::set<GeneId>& familyDuplications,
+                    std::map<int, int>& familyLosses, std::ostream& familyGroups) const
+    {
+        familyBirths.insert(births.begin(), births.end());
+        familyDuplications.insert(duplications.begin(), duplications.end());
+        for (const auto& loss : losses) familyLosses[loss.first] += loss.second;
+        familyGroups << orthoGroups;
+    }
+
+    void clear() {
+        std::set<GeneId>().swap(births);
+        std::set<GeneId>().swap(duplications);
+        std::map<int, int>().swap(losses);
+        std::string().swap(orthoGroups);
+    }
+};
+
+/**
+ * ComponentResult - Labeling of one connected component
+ *
+ * Computed by the first family that reaches the component and replayed
+ * by every other one, so each family still reports all of its groups.
+ */
+struct ComponentResult {
+    std::once_flag done;
+    std::atomic<uint32_t> pending;  // Families that have not replayed it yet
+    ComponentLabeling labeling;
+
+    ComponentResult() : pending(0) {}
+};
+
+namespace components {
+
+// Genes are linked and labeled in this many independent id ranges
+const size_t RANGES = 64;
+
+} // namespace components
+
+/**
+ * ComponentIndex - Connected components of the ortholog graph
+ *
+ * One parallel union-find pass over the edges labels every gene with its
+ * component. Ranges of genes link the edges of their rows concurrently;
+ * a link always hooks the larger root under the smaller one with a
+ * compare-and-swap, so there are no locks and the root of a component is
+ * its smallest gene, which serves as the component's label.
+ *
+ * Once the families are resolved, the components reached by more than
+ * one family get a shared ComponentResult slot.
+ */
+class ComponentIndex {
+private:
+    std::unique_ptr<std::atomic<GeneId>[]> parent;
+    std::vector<GeneId> labels;
+    std::vector<uint32_t> sizes;                         // Genes per component
+    std::unique_ptr<std::atomic<uint32_t>[]> families;  // Families per component
+    std::vector<uint32_t> slots;                         // Component -> shared slot
+    std::unique_ptr<ComponentResult[]> results;
+    size_t componentCount;
+    size_t sharedCount;
+
+    GeneId find(GeneId g) {
+        for (;;) {
+            GeneId p = parent[g].load(std::memory_order_relaxed);
+            if (p == g) return g;
+            // Path halving; losing the race only skips the shortcut
+            GeneId gp = parent[p].load(std::memory_order_relaxed);
+            if (gp != p) parent[g].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+            g = gp;
+        }
+    }
+
+    void unite(GeneId a, GeneId b) {
+        for (;;) {
+            a = find(a);
+            b = find(b);
+            if (a == b) return;
+            if (b < a) std::swap(a, b);
+            GeneId root = b;
+            if (parent[b].compare_exchange_strong(root, a, std::memory_order_relaxed)) return;
+        }
+    }
+
+    static GeneId rangeBegin(size_t r, size_t geneCount) {
+        return (GeneId)((uint64_t)geneCount * r / components::RANGES);
+    }
+
+    void initRange(size_t r, size_t geneCount) {
+        for (GeneId g = rangeBegin(r, geneCount); g < rangeBegin(r + 1, geneCount); g++)
+            parent[g].store(g, std::memory_order_relaxed);
+    }
+
+    // Each edge is linked once, from its smaller gene
+    void linkRange(size_t r, const OrthologGraph& graph) {
+        for (GeneId g = rangeBegin(r, graph.size()); g < rangeBegin(r + 1, graph.size()); g++) {
+            const GeneId* last = graph.end(g);
+            for (const GeneId* v = std::upper_bound(graph.begin(g), last, g); v != last; ++v)
+                unite(g, *v);
+        }
+    }
+
+    void labelRange(size_t r, size_t geneCount) {
+        for (GeneId g = rangeBegin(r, geneCount); g < rangeBegin(r + 1, geneCount); g++)
+            labels[g] = find(g);
+    }
+
+public:
+    ComponentIndex() : componentCount(0), sharedCount(0) {}
+
+    /**
+     * Add the labeling of graph to a task graph
+     * @return Node after which componentOf() is valid
+     */
+    size_t schedule(TaskGraph& stages, const OrthologGraph& graph, size_t after) {
+        using namespace components;
+        size_t prepared = stages.add([this, &graph]() {
+            parent.reset(new std::atomic<GeneId>[graph.size()]);
+            labels.resize(graph.size());
+        }, std::vector<size_t>(1, after));
+        size_t initialized = stages.addRange(RANGES, [this, &graph](size_t r) { initRange(r, graph.size()); },
+                                             std::vector<size_t>(1, prepared));
+        size_t linked = stages.addRange(RANGES, [this, &graph](size_t r) { linkRange(r, graph); },
+                                        std::vector<size_t>(1, initialized));
+        size_t labeled = stages.addRange(RANGES, [this, &graph](size_t r) { labelRange(r, graph.size()); },
+                                         std::vector<size_t>(1, linked));
+        return stages.add([this]() {
+            parent.reset();
+            componentCount = 0;
+            sizes.assign(labels.size(), 0);
+            for (GeneId g = 0; g < labels.size(); g++) {
+                if (labels[g] == g) componentCount++;
+                sizes[labels[g]]++;
+            }
+        }, std::vector<size_t>(1, labeled));
+    }
+
+    size_t size() const { return componentCount; }
+
+    /**
+     * Component of gene g, named by its smallest gene
+     */
+    GeneId componentOf(GeneId g) const { return labels[g]; }
+
+    /**
+     * Number of genes in a component
+     */
+    uint32_t componentSize(GeneId component) const { return sizes[component]; }
+
+    /**
+     * Count the families reaching each component, for families
+     * [first, last) of a resolved index; ranges may be counted concurrently
+     * once prepareSharing() has run
+     */
+    void countFamilies(const FamilyIndex& index, size_t first, size_t last) {
+        std::vector<GeneId> reached;
+        for (size_t f = first; f < last; f++) {
+            reached.clear();
+            for (const GeneId* g = index.begin(f); g != index.end(f); ++g) reached.push_back(labels[*g]);
+            std::sort(reached.begin(), reached.end());
+            reached.erase(std::unique(reached.begin(), reached.end()), reached.end());
+            for (size_t k = 0; k < reached.size(); k++)
+                families[reached[k]].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void prepareSharing() {
+        families.reset(new std::atomic<uint32_t>[labels.size()]);
+        for (size_t g = 0; g < labels.size(); g++) families[g].store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Give every component reached by several families a result slot
+     */
+    void assignShared() {
+        slots.assign(labels.size(), 0);
+        sharedCount = 0;
+        for (GeneId c = 0; c < labels.size(); c++)
+            if (families[c] > 1) slots[c] = (uint32_t)++sharedCount;
+        results.reset(new ComponentResult[sharedCount]);
+        for (GeneId c = 0; c < labels.size(); c++)
+            if (slots[c] > 0) results[slots[c] - 1].pending = families[c].load();
+        families.reset();
+    }
+
+    size_t sharedSize() const { return sharedCount; }
+
+    /**
+     * Result slot of a component, or nullptr if a single family reaches it
+     */
+    ComponentResult* shared(GeneId component) {
+        uint32_t slot = slots[component];
+        return slot > 0 ? &results[slot - 1] : nullptr;
+    }
+};
+
+#endif // COMPONENTINDEX_H
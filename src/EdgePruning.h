@@ -0,0 +1,171 @@
+#ifndef EDGEPRUNING_H
+#define EDGEPRUNING_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
+#include "PairFileParser.h"
+#include "GeneDictionary.h"
+#include "ThreadPool.h"
+
+/**
+ * Load-time pruning of ortholog pairs
+ *
+ * Policies apply per Si_Sj file, in this order:
+ *   min score        drop pairs scoring below a threshold
+ *   top-k            keep a pair only if it is among the k best pairs of
+ *                    at least one of its genes in that file
+ *   reciprocal best  keep a pair only if it is the best pair of both of
+ *                    its genes in that file
+ * Ranks are taken over the pairs that passed the score threshold, and
+ * ties at the cut-off score are kept. Kept pairs stay in load order.
+ */
+struct PruneOptions {
+    bool minScoreSet;
+    double minScore;
+    uint32_t topK;        // 0: no top-k pruning
+    bool reciprocalBest;
+
+    PruneOptions() : minScoreSet(false), minScore(0.0), topK(0), reciprocalBest(false) {}
+
+    bool any() const { return minScoreSet || topK > 0 || reciprocalBest; }
+
+    // Top-k and reciprocal best need every pair of a file at once
+    bool ranked() const { return topK > 0 || reciprocalBest; }
+
+    bool operator==(const PruneOptions& o) const {
+        return minScoreSet == o.minScoreSet && (!minScoreSet || minScore == o.minScore) &&
+               topK == o.topK && reciprocalBest == o.reciprocalBest;
+    }
+
+    std::string describe() const {
+        if (!any()) return "none";
+        std::stringstream ss;
+        const char* sep = "";
+        if (minScoreSet) { ss << "min score " << minScore; sep = ", "; }
+        if (topK > 0) { ss << sep << "top-" << topK; sep = ", "; }
+        if (reciprocalBest) ss << sep << "reciprocal best";
+        return ss.str();
+    }
+};
+
+/**
+ * PruneStats - Pair counts of one load, updated concurrently by the loaders
+ */
+struct PruneStats {
+    std::atomic<uint64_t> parsed;
+    std::atomic<uint64_t> belowMinScore;
+    std::atomic<uint64_t> outsideTopK;
+    std::atomic<uint64_t> notReciprocal;
+
+    PruneStats() : parsed(0), belowMinScore(0), outsideTopK(0), notReciprocal(0) {}
+
+    uint64_t dropped() const { return belowMinScore + outsideTopK + notReciprocal; }
+};
+
+namespace edgeprune {
+
+struct GeneViewHash {
+    size_t operator()(const GeneView& v) const { return (size_t)hashGeneName(v.data, v.length); }
+};
+
+} // namespace edgeprune
+
+/**
+ * Drop the pairs of one chunk that score below the threshold
+ */
+inline void pruneByScore(std::vector<OrthologPair>& pairs, const PruneOptions& options,
+                         PruneStats& stats)
+{
+    if (!options.minScoreSet) return;
+    double minScore = options.minScore;
+    size_t before = pairs.size();
+    pairs.erase(std::remove_if(pairs.begin(), pairs.end(),
+                               [minScore](const OrthologPair& p) { return p.score < minScore; }),
+                pairs.end());
+    stats.belowMinScore += before - pairs.size();
+}
+
+/**
+ * Apply top-k and reciprocal-best pruning to all chunks of one file
+ */
+inline void pruneByRank(std::vector<PairChunk>& chunks, const PruneOptions& options,
+                        PruneStats& stats)
+{
+    if (!options.ranked()) return;
+
+    // Local index of every gene of the file; occurrence 2p / 2p+1 of the
+    // file-wide pair p are its two genes
+    std::unordered_map<GeneView, uint32_t, edgeprune::GeneViewHash> index;
+    std::vector<uint32_t> occGene;
+    std::vector<uint64_t> degree;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        for (size_t p = 0; p < chunks[c].pairs.size(); p++) {
+            const OrthologPair& pair = chunks[c].pairs[p];
+            for (int side = 0; side < 2; side++) {
+                const GeneView& v = side ? pair.gene2 : pair.gene1;
+                auto it = index.insert(std::make_pair(v, (uint32_t)degree.size())).first;
+                if (it->second == degree.size()) degree.push_back(0);
+                degree[it->second]++;
+                occGene.push_back(it->second);
+            }
+        }
+    }
+
+    // Scores of every gene, grouped by gene
+    std::vector<uint64_t> start(degree.size() + 1, 0);
+    for (size_t g = 0; g < degree.size(); g++) start[g + 1] = start[g] + degree[g];
+    std::vector<double> scores(start.back());
+    std::vector<uint64_t> fill(start.begin(), start.end() - 1);
+    size_t occ = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        for (size_t p = 0; p < chunks[c].pairs.size(); p++, occ += 2) {
+            scores[fill[occGene[occ]]++] = chunks[c].pairs[p].score;
+            scores[fill[occGene[occ + 1]]++] = chunks[c].pairs[p].score;
+        }
+    }
+
+    // Best and k-th best score of every gene
+    std::vector<double> best(degree.size()), kth(degree.size());
+    for (size_t g = 0; g < degree.size(); g++) {
+        double* first = &scores[start[g]];
+        double* last = &scores[start[g + 1]];
+        best[g] = *std::max_element(first, last);
+        if (options.topK > 0) {
+            if ((uint64_t)options.topK >= degree[g]) {
+                kth[g] = *std::min_element(first, last);
+            } else {
+                double* nth = first + (options.topK - 1);
+                std::nth_element(first, nth, last, [](double a, double b) { return a > b; });
+                kth[g] = *nth;
+            }
+        }
+    }
+
+    uint64_t outsideTopK = 0, notReciprocal = 0;
+    occ = 0;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        std::vector<OrthologPair>& pairs = chunks[c].pairs;
+        size_t kept = 0;
+        for (size_t p = 0; p < pairs.size(); p++, occ += 2) {
+            uint32_t a = occGene[occ], b = occGene[occ + 1];
+            double score = pairs[p].score;
+            if (options.topK > 0 && score < kth[a] && score < kth[b]) {
+                outsideTopK++;
+            } else if (options.reciprocalBest && (score < best[a] || score < best[b])) {
+                notReciprocal++;
+            } else {
+                pairs[kept++] = pairs[p];
+            }
+        }
+        pairs.resize(kept);
+    }
+    stats.outsideTopK += outsideTopK;
+    stats.notReciprocal += notReciprocal;
+}
+
+#endif // EDGEPRUNING_H
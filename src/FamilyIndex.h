@@ -0,0 +1,121 @@
+#ifndef FAMILYINDEX_H
+#define FAMILYINDEX_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include "MappedFile.h"
+#include "PairFileParser.h"
+#include "GeneDictionary.h"
+
+/**
+ * FamilyIndex - All gene families as one flat array with offsets
+ *
+ * The family file (one family per line, names separated by whitespace) is
+ * parsed straight from its mapping into name views plus per-family
+ * offsets; lines without any name are not families. Once the graph is
+ * loaded, resolve() turns the names into gene ids in place: each family
+ * becomes its sorted, duplicate-free known ids, the same genes in the
+ * same order a set of names would give. Family tasks then only need the
+ * index of their family.
+ */
+class FamilyIndex {
+private:
+    MappedFile file;
+    std::vector<GeneView> names;
+    std::vector<GeneId> members;
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> counts;  // Resolved ids per family, before compact()
+
+public:
+    FamilyIndex() : offsets(1, 0) {}
+
+    /**
+     * Map and parse a family file
+     * @return false if the file cannot be opened
+     */
+    bool open(const std::string& path) {
+        file = MappedFile(path);
+        names.clear();
+        offsets.assign(1, 0);
+        if (!file.is_open()) return false;
+
+        const char* p = file.data();
+        const char* end = file.end();
+        while (p < end) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', (size_t)(end - p)));
+            if (eol == nullptr) eol = end;
+
+            const char* q = p;
+            while (q < eol) {
+                while (q < eol && pairparser::isBlank(*q)) ++q;
+                if (q == eol) break;
+                const char* token = q;
+                while (q < eol && !pairparser::isBlank(*q)) ++q;
+                names.push_back(GeneView(token, (uint32_t)(q - token)));
+            }
+            if (names.size() > offsets.back()) offsets.push_back(names.size());
+
+            p = eol + 1;
+        }
+        return true;
+    }
+
+    size_t size() const { return offsets.size() - 1; }
+
+    /**
+     * Every gene name of every family, as parsed; valid until compact()
+     */
+    const std::vector<GeneView>& geneNames() const { return names; }
+
+    /**
+     * Resolve the names of families [first, last) to ids; disjoint ranges
+     * may be resolved concurrently. Unknown names are dropped.
+     */
+    void resolve(const GeneDictionary& genes, size_t first, size_t last) {
+        for (size_t f = first; f < last; f++) {
+            GeneId* out = members.data() + offsets[f];
+            uint32_t n = 0;
+            for (uint64_t k = offsets[f]; k < offsets[f + 1]; k++) {
+                GeneId id = genes.find(names[k].data, names[k].length);
+                if (id != NO_GENE) out[n++] = id;
+            }
+            std::sort(out, out + n);
+            counts[f] = (uint32_t)(std::unique(out, out + n) - out);
+        }
+    }
+
+    /**
+     * Size the id array before resolve()
+     */
+    void prepare() {
+        members.resize(names.size());
+        counts.assign(size(), 0);
+    }
+
+    /**
+     * Close the gaps left by dropped names once every family is resolved,
+     * and release the names and the mapping
+     */
+    void compact() {
+        uint64_t at = 0;
+        for (size_t f = 0; f < size(); f++) {
+            std::memmove(members.data() + at, members.data() + offsets[f], counts[f] * sizeof(GeneId));
+            offsets[f] = at;
+            at += counts[f];
+        }
+        offsets[size()] = at;
+        members.resize(at);
+
+        std::vector<uint32_t>().swap(counts);
+        std::vector<GeneView>().swap(names);
+        file = MappedFile();
+    }
+
+    const GeneId* begin(size_t f) const { return members.data() + offsets[f]; }
+    const GeneId* end(size_t f) const { return members.data() + offsets[f + 1]; }
+};
+
+#endif // FAMILYINDEX_H
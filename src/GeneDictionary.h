@@ -0,0 +1,241 @@
+#ifndef GENEDICTIONARY_H
+#define GENEDICTIONARY_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cstring>
+#include <stdint.h>
+
+/**
+ * Dense 32-bit gene identifier; NO_GENE marks a dummy (padding) gene
+ */
+typedef uint32_t GeneId;
+const GeneId NO_GENE = 0xFFFFFFFFu;
+
+inline uint64_t hashGeneName(const char* s, size_t n) {
+    // 64-bit FNV-1a over 8-byte words, finished with a murmur3 mix
+    uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t)n;
+    while (n >= 8) {
+        uint64_t w;
+        std::memcpy(&w, s, 8);
+        h = (h ^ w) * 0x100000001b3ULL;
+        s += 8;
+        n -= 8;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, s, n);
+    h = (h ^ tail) * 0x100000001b3ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * GeneDictionary - Interns every gene name to a dense GeneId
+ *
+ * Names are stored once in a contiguous byte arena and looked up through
+ * an open-addressing table. The species of each gene is kept alongside, so
+ * it is an O(1) array read by id. After loading, sortByName() renumbers
+ * ids into name order: ordering by id is then ordering by name, which
+ * keeps every id-ordered set in the same order its strings would have.
+ */
+class GeneDictionary {
+private:
+    std::vector<char> bytes;
+    std::vector<uint64_t> offsets;
+    std::vector<int> geneSpecies;
+
+    // Open-addressing table: id per slot (NO_GENE if empty) plus a hash tag
+    std::vector<GeneId> slotIds;
+    std::vector<uint32_t> slotTags;
+    size_t mask;
+
+    bool equals(GeneId id, const char* s, uint32_t n) const {
+        return offsets[id + 1] - offsets[id] == n &&
+               std::memcmp(bytes.data() + offsets[id], s, n) == 0;
+    }
+
+    void rehash(size_t capacity) {
+        slotIds.assign(capacity, NO_GENE);
+        slotTags.assign(capacity, 0);
+        mask = capacity - 1;
+        for (GeneId id = 0; id < size(); id++) {
+            uint64_t h = hashGeneName(nameData(id), nameLength(id));
+            size_t slot = (size_t)h & mask;
+            while (slotIds[slot] != NO_GENE) slot = (slot + 1) & mask;
+            slotIds[slot] = id;
+            slotTags[slot] = (uint32_t)(h >> 32);
+        }
+    }
+
+public:
+    GeneDictionary() : offsets(1, 0), mask(0) {
+        rehash(1024);
+    }
+
+    size_t size() const { return offsets.size() - 1; }
+
+    /**
+     * Look up a name without inserting it
+     * @return Its id, or NO_GENE if the name was never interned
+     */
+    GeneId find(const char* s, uint32_t n) const {
+        uint64_t h = hashGeneName(s, n);
+        uint32_t tag = (uint32_t)(h >> 32);
+        for (size_t slot = (size_t)h & mask; slotIds[slot] != NO_GENE; slot = (slot + 1) & mask) {
+            if (slotTags[slot] == tag && equals(slotIds[slot], s, n)) return slotIds[slot];
+        }
+        return NO_GENE;
+    }
+
+    GeneId find(const std::string& name) const {
+        return find(name.data(), (uint32_t)name.size());
+    }
+
+    /**
+     * Return the id of a name, interning it on first sight
+     */
+    GeneId intern(const char* s, uint32_t n) {
+        uint64_t h = hashGeneName(s, n);
+        uint32_t tag = (uint32_t)(h >> 32);
+        size_t slot = (size_t)h & mask;
+        for (; slotIds[slot] != NO_GENE; slot = (slot + 1) & mask) {
+            if (slotTags[slot] == tag && equals(slotIds[slot], s, n)) return slotIds[slot];
+        }
+
+        GeneId id = (GeneId)size();
+        bytes.insert(bytes.end(), s, s + n);
+        offsets.push_back(bytes.size());
+        geneSpecies.push_back(-1);
+        slotIds[slot] = id;
+        slotTags[slot] = tag;
+
+        // Keep the load factor at or below 1/2
+        if (2 * size() > slotIds.size()) rehash(2 * slotIds.size());
+        return id;
+    }
+
+    const char* nameData(GeneId id) const { return bytes.data() + offsets[id]; }
+    uint32_t nameLength(GeneId id) const { return (uint32_t)(offsets[id + 1] - offsets[id]); }
+    std::string name(GeneId id) const { return std::string(nameData(id), nameLength(id)); }
+
+    int speciesOf(GeneId id) const { return geneSpecies[id]; }
+    void setSpecies(GeneId id, int sp) { geneSpecies[id] = sp; }
+
+    /**
+     * Renumber ids so that id order equals name order
+     * @return Mapping from old id to new id
+     */
+    std::vector<GeneId> sortByName() {
+        std::vector<GeneId> order(size());
+        for (GeneId id = 0; id < size(); id++) order[id] = id;
+        std::sort(order.begin(), order.end(), [this](GeneId a, GeneId b) {
+            uint32_t la = nameLength(a), lb = nameLength(b);
+            int c = std::memcmp(nameData(a), nameData(b), std::min(la, lb));
+            return c != 0 ? c < 0 : la < lb;
+        });
+
+        std::vector<GeneId> remap(size());
+        std::vector<char> sortedBytes;
+        sortedBytes.reserve(bytes.size());
+        std::vector<uint64_t> sortedOffsets(1, 0);
+        std::vector<int> sortedSpecies(size());
+        for (GeneId k = 0; k < order.size(); k++) {
+            GeneId old = order[k];
+            remap[old] = k;
+            sortedBytes.insert(sortedBytes.end(), nameData(old), nameData(old) + nameLength(old));
+            sortedOffsets.push_back(sortedBytes.size());
+            sortedSpecies[k] = geneSpecies[old];
+        }
+
+        bytes.swap(sortedBytes);
+        offsets.swap(sortedOffsets);
+        geneSpecies.swap(sortedSpecies);
+        rehash(slotIds.size());
+        return remap;
+    }
+
+    /**
+     * Replace the contents with genes already in name order
+     * @param nameBytes Concatenated names
+     * @param nameOffsets count+1 offsets into nameBytes
+     * @param species Species of each gene
+     */
+    void assignSorted(const char* nameBytes, const uint64_t* nameOffsets,
+                      const int32_t* species, size_t count)
+    {
+        bytes.assign(nameBytes, nameBytes + nameOffsets[count]);
+        offsets.assign(nameOffsets, nameOffsets + count + 1);
+        geneSpecies.assign(species, species + count);
+
+        size_t capacity = 1024;
+        while (capacity < 2 * count) capacity *= 2;
+        rehash(capacity);
+    }
+
+    /**
+     * Replace the contents with the union of disjoint dictionaries that
+     * have each been sorted by name (k-way merge)
+     * @param globalIds Receives, for every part, the new id of each of its genes
+     */
+    void mergeSorted(const std::vector<const GeneDictionary*>& parts,
+                     std::vector<std::vector<GeneId> >& globalIds)
+    {
+        size_t count = 0, byteCount = 0;
+        for (size_t p = 0; p < parts.size(); p++) {
+            count += parts[p]->size();
+            byteCount += parts[p]->bytes.size();
+        }
+
+        bytes.clear();
+        bytes.reserve(byteCount);
+        offsets.assign(1, 0);
+        offsets.reserve(count + 1);
+        geneSpecies.clear();
+        geneSpecies.reserve(count);
+        globalIds.assign(parts.size(), std::vector<GeneId>());
+
+        // Min-heap of the next unmerged gene of every part
+        typedef std::pair<size_t, GeneId> Cursor;
+        std::vector<Cursor> heap;
+        auto greater = [&parts](const Cursor& a, const Cursor& b) {
+            const GeneDictionary& da = *parts[a.first];
+            const GeneDictionary& db = *parts[b.first];
+            uint32_t la = da.nameLength(a.second), lb = db.nameLength(b.second);
+            int c = std::memcmp(da.nameData(a.second), db.nameData(b.second), std::min(la, lb));
+            return c != 0 ? c > 0 : la > lb;
+        };
+        for (size_t p = 0; p < parts.size(); p++) {
+            globalIds[p].resize(parts[p]->size());
+            if (parts[p]->size() > 0) heap.push_back(Cursor(p, 0));
+        }
+        std::make_heap(heap.begin(), heap.end(), greater);
+
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            Cursor c = heap.back();
+            heap.pop_back();
+
+            const GeneDictionary& part = *parts[c.first];
+            globalIds[c.first][c.second] = (GeneId)geneSpecies.size();
+            bytes.insert(bytes.end(), part.nameData(c.second),
+                         part.nameData(c.second) + part.nameLength(c.second));
+            offsets.push_back(bytes.size());
+            geneSpecies.push_back(part.speciesOf(c.second));
+
+            if (c.second + 1 < part.size()) {
+                heap.push_back(Cursor(c.first, c.second + 1));
+                std::push_heap(heap.begin(), heap.end(), greater);
+            }
+        }
+
+        size_t capacity = 1024;
+        while (capacity < 2 * count) capacity *= 2;
+        rehash(capacity);
+    }
+};
+
+#endif // GENEDICTIONARY_H
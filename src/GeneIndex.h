@@ -0,0 +1,256 @@
+#ifndef GENEINDEX_H
+#define GENEINDEX_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include "MappedFile.h"
+#include "PairFileParser.h"
+#include "GeneDictionary.h"
+#include "GraphCache.h"
+
+/**
+ * On-disk gene index (.mmsi)
+ *
+ * Locates every line of the Si_Sj pair files by gene, so a run restricted
+ * to a few families can read just the lines of their connected components.
+ * Layout follows the graph cache: 8-byte aligned native arrays.
+ *
+ *   header            GeneIndexHeader
+ *   inputs            GraphCacheInput[inputCount]   size/mtime of every Si_Sj
+ *   name offsets      uint64[geneCount+1]           into the name bytes
+ *   names             char[nameBytes]               gene names, sorted
+ *   posting offsets   uint64[geneCount+1]           row starts
+ *   neighbors         uint32[postingCount]          other gene of each line
+ *   lines             uint64[postingCount]          line position, see below
+ *
+ * A line position is (input << 48) | byte offset of the line's first field
+ * in the input's text (the inflated text for a block-compressed input).
+ * Rows are in load order, which is ascending line position.
+ */
+
+static const char GENE_INDEX_MAGIC[4] = { 'M', 'M', 'S', 'I' };
+static const uint32_t GENE_INDEX_VERSION = 1;
+
+struct GeneIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t speciesCount;
+    uint64_t inputCount;
+    uint64_t geneCount;
+    uint64_t postingCount;
+    uint64_t nameBytes;
+
+    uint64_t inputsOffset;
+    uint64_t nameOffsetsOffset;
+    uint64_t namesOffset;
+    uint64_t postingOffsetsOffset;
+    uint64_t neighborsOffset;
+    uint64_t linesOffset;
+    uint64_t fileSize;
+};
+
+inline uint64_t lineInput(uint64_t line) { return line >> 48; }
+inline uint64_t lineOffset(uint64_t line) { return line & ((1ULL << 48) - 1); }
+
+/**
+ * Write the gene index of a load
+ * @param rows Load-ordered rows with one entry per line and gene, and the
+ *             line position of every entry (see GraphBuilder::recordLines)
+ * @return false if the file could not be written
+ */
+inline bool writeGeneIndex(const std::string& path, int S, const GeneDictionary& genes,
+                           const std::vector<uint64_t>& rows, const std::vector<GeneId>& neighbors,
+                           const std::vector<uint64_t>& lines)
+{
+    using namespace graphcache;
+
+    std::vector<GraphCacheInput> inputs;
+    for (int i = 0; i < S; i++)
+        for (int j = i + 1; j < S; j++)
+            inputs.push_back(statPairFile(i, j));
+
+    std::vector<uint64_t> nameOffsets(1, 0);
+    std::vector<char> nameBytes;
+    for (GeneId g = 0; g < genes.size(); g++) {
+        nameBytes.insert(nameBytes.end(), genes.nameData(g), genes.nameData(g) + genes.nameLength(g));
+        nameOffsets.push_back(nameBytes.size());
+    }
+
+    std::vector<uint64_t> emptyRow(1, 0);
+    const uint64_t* postingOffsets = genes.size() > 0 ? rows.data() : emptyRow.data();
+    uint64_t postingCount = neighbors.size();
+
+    GeneIndexHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, GENE_INDEX_MAGIC, 4);
+    h.version = GENE_INDEX_VERSION;
+    h.byteOrder = GRAPH_CACHE_BYTE_ORDER;
+    h.speciesCount = (uint32_t)S;
+    h.inputCount = inputs.size();
+    h.geneCount = genes.size();
+    h.postingCount = postingCount;
+    h.nameBytes = nameBytes.size();
+
+    h.inputsOffset = align8(sizeof(GeneIndexHeader));
+    h.nameOffsetsOffset = align8(h.inputsOffset + inputs.size() * sizeof(GraphCacheInput));
+    h.namesOffset = align8(h.nameOffsetsOffset + nameOffsets.size() * sizeof(uint64_t));
+    h.postingOffsetsOffset = align8(h.namesOffset + nameBytes.size());
+    h.neighborsOffset = align8(h.postingOffsetsOffset + (genes.size() + 1) * sizeof(uint64_t));
+    h.linesOffset = align8(h.neighborsOffset + postingCount * sizeof(uint32_t));
+    h.fileSize = h.linesOffset + postingCount * sizeof(uint64_t);
+
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+
+    writeSection(out, 0, &h, 1);
+    writeSection(out, h.inputsOffset, inputs.data(), inputs.size());
+    writeSection(out, h.nameOffsetsOffset, nameOffsets.data(), nameOffsets.size());
+    writeSection(out, h.namesOffset, nameBytes.data(), nameBytes.size());
+    writeSection(out, h.postingOffsetsOffset, postingOffsets, genes.size() + 1);
+    writeSection(out, h.neighborsOffset, neighbors.data(), postingCount);
+    writeSection(out, h.linesOffset, lines.data(), postingCount);
+
+    out.close();
+    return !out.fail();
+}
+
+/**
+ * GeneIndex - Read-only view of a mapped .mmsi file
+ *
+ * open() validates the header and checks every recorded Si_Sj input
+ * against the file system; on failure reason() says why.
+ */
+class GeneIndex {
+private:
+    MappedFile file;
+    const GeneIndexHeader* header;
+    std::string why;
+
+    template<class T>
+    const T* section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(file.data() + offset);
+    }
+
+public:
+    GeneIndex() : header(nullptr) {}
+
+    bool open(const std::string& path, int S) {
+        file = MappedFile(path);
+        header = nullptr;
+        if (!file.is_open()) {
+            why = "cannot open " + path;
+            return false;
+        }
+        const GeneIndexHeader* h = reinterpret_cast<const GeneIndexHeader*>(file.data());
+        if (file.size() < sizeof(GeneIndexHeader) || std::memcmp(h->magic, GENE_INDEX_MAGIC, 4) != 0 ||
+            h->byteOrder != GRAPH_CACHE_BYTE_ORDER) {
+            why = path + " is not a gene index";
+            return false;
+        }
+        if (h->version != GENE_INDEX_VERSION) {
+            why = path + " was written by an incompatible version";
+            return false;
+        }
+        if (h->fileSize != file.size()) {
+            why = path + " is truncated";
+            return false;
+        }
+        if (h->speciesCount != (uint32_t)S) {
+            std::stringstream ss;
+            ss << path << " was built for " << h->speciesCount << " species";
+            why = ss.str();
+            return false;
+        }
+
+        const GraphCacheInput* inputs = section<GraphCacheInput>(h->inputsOffset);
+        for (uint64_t k = 0; k < h->inputCount; k++) {
+            GraphCacheInput now = statPairFile(inputs[k].i, inputs[k].j);
+            if (now.size != inputs[k].size || now.mtimeSec != inputs[k].mtimeSec ||
+                now.mtimeNsec != inputs[k].mtimeNsec) {
+                why = pairFileName(inputs[k].i, inputs[k].j) + " changed since " + path + " was built";
+                return false;
+            }
+        }
+
+        header = h;
+        return true;
+    }
+
+    const std::string& reason() const { return why; }
+
+    uint64_t geneCount() const { return header->geneCount; }
+    uint64_t postingCount() const { return header->postingCount; }
+
+    /**
+     * Binary search for a gene name
+     * @return Its index, or NO_GENE
+     */
+    GeneId find(const char* s, uint32_t n) const {
+        const uint64_t* offsets = section<uint64_t>(header->nameOffsetsOffset);
+        const char* names = section<char>(header->namesOffset);
+        uint64_t lo = 0, hi = header->geneCount;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            uint32_t len = (uint32_t)(offsets[mid + 1] - offsets[mid]);
+            int c = std::memcmp(names + offsets[mid], s, std::min(len, n));
+            if (c < 0 || (c == 0 && len < n)) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo < header->geneCount && offsets[lo + 1] - offsets[lo] == n &&
+            std::memcmp(names + offsets[lo], s, n) == 0) return (GeneId)lo;
+        return NO_GENE;
+    }
+
+    /**
+     * Collect the lines of every connected component that contains one of
+     * the seed genes
+     * @param linesPerInput Receives the sorted, distinct line offsets to
+     *                      read from each input
+     * @return Number of genes reached
+     */
+    size_t collectComponents(const std::vector<GeneView>& seeds,
+                             std::vector<std::vector<uint64_t> >& linesPerInput) const
+    {
+        const uint64_t* rows = section<uint64_t>(header->postingOffsetsOffset);
+        const uint32_t* neighbors = section<uint32_t>(header->neighborsOffset);
+        const uint64_t* lines = section<uint64_t>(header->linesOffset);
+
+        std::vector<char> reached(header->geneCount, 0);
+        std::vector<GeneId> queue;
+        for (size_t k = 0; k < seeds.size(); k++) {
+            GeneId g = find(seeds[k].data, seeds[k].length);
+            if (g != NO_GENE && !reached[g]) {
+                reached[g] = 1;
+                queue.push_back(g);
+            }
+        }
+
+        linesPerInput.assign(header->inputCount, std::vector<uint64_t>());
+        for (size_t head = 0; head < queue.size(); head++) {
+            GeneId g = queue[head];
+            for (uint64_t k = rows[g]; k < rows[g + 1]; k++) {
+                // Lines are listed under both of their genes; duplicates go below
+                linesPerInput[lineInput(lines[k])].push_back(lineOffset(lines[k]));
+                if (!reached[neighbors[k]]) {
+                    reached[neighbors[k]] = 1;
+                    queue.push_back(neighbors[k]);
+                }
+            }
+        }
+
+        for (size_t t = 0; t < linesPerInput.size(); t++) {
+            std::vector<uint64_t>& v = linesPerInput[t];
+            std::sort(v.begin(), v.end());
+            v.erase(std::unique(v.begin(), v.end()), v.end());
+        }
+        return queue.size();
+    }
+};
+
+#endif // GENEINDEX_H
@@ -0,0 +1,288 @@
+#ifndef GRAPHCACHE_H
+#define GRAPHCACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "MappedFile.h"
+#include "PairFileParser.h"
+#include "GeneDictionary.h"
+#include "OrthologGraph.h"
+#include "EdgePruning.h"
+
+/**
+ * Binary ortholog graph cache (.mmsg)
+ *
+ * A compiled snapshot of all Si_Sj pair files, so repeat runs skip text
+ * parsing. All sections are 8-byte aligned arrays in native byte order:
+ *
+ *   header         GraphCacheHeader
+ *   inputs         GraphCacheInput[inputCount]   size/mtime of every Si_Sj
+ *   name offsets   uint64[geneCount+1]           into the name bytes
+ *   names          char[nameBytes]               gene names, sorted
+ *   species        int32[geneCount]              species of each gene
+ *   adj offsets    uint64[geneCount+1]           CSR row starts
+ *   edge offsets   uint64[geneCount+1]           row starts in weights
+ *   neighbors      uint32[adjacencyCount]        gene ids, ascending per row
+ *   weights        double[edgeCount]             score of each edge
+ *
+ * A cache is stale as soon as any recorded input changed size or mtime,
+ * and only matches runs with the pruning options it was compiled with.
+ * The CSR sections are used in place, straight from the mapping.
+ */
+
+static const char GRAPH_CACHE_MAGIC[4] = { 'M', 'M', 'S', 'G' };
+static const uint32_t GRAPH_CACHE_VERSION = 3;
+static const uint32_t GRAPH_CACHE_BYTE_ORDER = 0x01020304;
+
+struct GraphCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t speciesCount;
+    uint64_t inputCount;
+    uint64_t geneCount;
+    uint64_t adjacencyCount;
+    uint64_t edgeCount;
+    uint64_t nameBytes;
+
+    uint64_t inputsOffset;
+    uint64_t nameOffsetsOffset;
+    uint64_t namesOffset;
+    uint64_t speciesOffset;
+    uint64_t adjOffsetsOffset;
+    uint64_t edgeOffsetsOffset;
+    uint64_t neighborsOffset;
+    uint64_t weightsOffset;
+    uint64_t fileSize;
+
+    // Pruning applied while compiling (see PruneOptions)
+    uint32_t minScoreSet;
+    uint32_t topK;
+    double minScore;
+    uint32_t reciprocalBest;
+    uint32_t reserved;
+};
+
+/**
+ * GraphCacheInput - Identity of one Si_Sj input at compile time
+ * size is -1 when the file did not exist.
+ */
+struct GraphCacheInput {
+    int32_t i, j;
+    int64_t size;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+};
+
+inline GraphCacheInput statPairFile(int i, int j) {
+    GraphCacheInput in;
+    in.i = i;
+    in.j = j;
+    in.size = -1;
+    in.mtimeSec = 0;
+    in.mtimeNsec = 0;
+
+    struct stat st;
+    if (stat(resolvePairFile(i, j).c_str(), &st) == 0) {
+        in.size = (int64_t)st.st_size;
+        in.mtimeSec = (int64_t)st.st_mtim.tv_sec;
+        in.mtimeNsec = (int64_t)st.st_mtim.tv_nsec;
+    }
+    return in;
+}
+
+namespace graphcache {
+
+inline uint64_t align8(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+// Sections are written in file order; zero-pad up to each aligned offset
+template<class T>
+void writeSection(std::ofstream& out, uint64_t offset, const T* data, size_t count) {
+    static const char zeros[8] = { 0 };
+    uint64_t at = (uint64_t)out.tellp();
+    if (offset > at) out.write(zeros, (std::streamsize)(offset - at));
+    if (count > 0) {
+        out.write(reinterpret_cast<const char*>(data), (std::streamsize)(count * sizeof(T)));
+    }
+}
+
+} // namespace graphcache
+
+/**
+ * Write a cache of the loaded ortholog graph
+ * @param path Output .mmsg file
+ * @param S Number of species the pair files were loaded for
+ * @param pruning Pruning the graph was loaded with
+ * @return false if the file could not be written
+ */
+inline bool writeGraphCache(const std::string& path, int S, const PruneOptions& pruning,
+                            const GeneDictionary& genes, const OrthologGraph& graph)
+{
+    using namespace graphcache;
+
+    std::vector<GraphCacheInput> inputs;
+    for (int i = 0; i < S; i++)
+        for (int j = i + 1; j < S; j++)
+            inputs.push_back(statPairFile(i, j));
+
+    // Gene ids are already in name order
+    std::vector<uint64_t> nameOffsets(1, 0);
+    std::vector<char> nameBytes;
+    std::vector<int32_t> geneSpecies;
+    for (GeneId g = 0; g < genes.size(); g++) {
+        nameBytes.insert(nameBytes.end(), genes.nameData(g), genes.nameData(g) + genes.nameLength(g));
+        nameOffsets.push_back(nameBytes.size());
+        geneSpecies.push_back(genes.speciesOf(g));
+    }
+
+    // The CSR arrays are written as they are
+    std::vector<uint64_t> emptyRow(1, 0);
+    const uint64_t* adjOffsets = graph.size() > 0 ? graph.offsets() : emptyRow.data();
+    const uint64_t* edgeOffsets = graph.size() > 0 ? graph.edgeOffsets() : emptyRow.data();
+    uint64_t adjacencyCount = graph.halfEdgeCount();
+    uint64_t edgeCount = graph.edgeCount();
+
+    GraphCacheHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, GRAPH_CACHE_MAGIC, 4);
+    h.version = GRAPH_CACHE_VERSION;
+    h.byteOrder = GRAPH_CACHE_BYTE_ORDER;
+    h.speciesCount = (uint32_t)S;
+    h.inputCount = inputs.size();
+    h.geneCount = genes.size();
+    h.adjacencyCount = adjacencyCount;
+    h.edgeCount = edgeCount;
+    h.nameBytes = nameBytes.size();
+    h.minScoreSet = pruning.minScoreSet ? 1 : 0;
+    h.topK = pruning.topK;
+    h.minScore = pruning.minScore;
+    h.reciprocalBest = pruning.reciprocalBest ? 1 : 0;
+
+    h.inputsOffset = align8(sizeof(GraphCacheHeader));
+    h.nameOffsetsOffset = align8(h.inputsOffset + inputs.size() * sizeof(GraphCacheInput));
+    h.namesOffset = align8(h.nameOffsetsOffset + nameOffsets.size() * sizeof(uint64_t));
+    h.speciesOffset = align8(h.namesOffset + nameBytes.size());
+    h.adjOffsetsOffset = align8(h.speciesOffset + geneSpecies.size() * sizeof(int32_t));
+    h.edgeOffsetsOffset = align8(h.adjOffsetsOffset + (genes.size() + 1) * sizeof(uint64_t));
+    h.neighborsOffset = align8(h.edgeOffsetsOffset + (genes.size() + 1) * sizeof(uint64_t));
+    h.weightsOffset = align8(h.neighborsOffset + adjacencyCount * sizeof(uint32_t));
+    h.fileSize = h.weightsOffset + edgeCount * sizeof(double);
+
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+
+    writeSection(out, 0, &h, 1);
+    writeSection(out, h.inputsOffset, inputs.data(), inputs.size());
+    writeSection(out, h.nameOffsetsOffset, nameOffsets.data(), nameOffsets.size());
+    writeSection(out, h.namesOffset, nameBytes.data(), nameBytes.size());
+    writeSection(out, h.speciesOffset, geneSpecies.data(), geneSpecies.size());
+    writeSection(out, h.adjOffsetsOffset, adjOffsets, genes.size() + 1);
+    writeSection(out, h.edgeOffsetsOffset, edgeOffsets, genes.size() + 1);
+    writeSection(out, h.neighborsOffset, graph.neighbors(), adjacencyCount);
+    writeSection(out, h.weightsOffset, graph.weights(), edgeCount);
+
+    out.close();
+    return !out.fail();
+}
+
+/**
+ * GraphCache - Read-only view of a mapped .mmsg file
+ *
+ * open() validates the header and checks every recorded Si_Sj input
+ * against the file system; on failure reason() says why.
+ */
+class GraphCache {
+private:
+    MappedFile file;
+    const GraphCacheHeader* header;
+    std::string why;
+
+    template<class T>
+    const T* section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(file.data() + offset);
+    }
+
+public:
+    GraphCache() : header(nullptr) {}
+
+    bool open(const std::string& path, int S, const PruneOptions& pruning) {
+        file = MappedFile(path);
+        header = nullptr;
+        if (!file.is_open()) {
+            why = "cannot open " + path;
+            return false;
+        }
+        if (file.size() < sizeof(GraphCacheHeader)) {
+            why = path + " is not a graph cache";
+            return false;
+        }
+
+        const GraphCacheHeader* h = reinterpret_cast<const GraphCacheHeader*>(file.data());
+        if (std::memcmp(h->magic, GRAPH_CACHE_MAGIC, 4) != 0 || h->byteOrder != GRAPH_CACHE_BYTE_ORDER) {
+            why = path + " is not a graph cache";
+            return false;
+        }
+        if (h->version != GRAPH_CACHE_VERSION) {
+            why = path + " was written by an incompatible version";
+            return false;
+        }
+        if (h->fileSize != file.size()) {
+            why = path + " is truncated";
+            return false;
+        }
+        if (h->speciesCount != (uint32_t)S) {
+            std::stringstream ss;
+            ss << path << " was compiled for " << h->speciesCount << " species";
+            why = ss.str();
+            return false;
+        }
+
+        PruneOptions compiled;
+        compiled.minScoreSet = h->minScoreSet != 0;
+        compiled.minScore = h->minScore;
+        compiled.topK = h->topK;
+        compiled.reciprocalBest = h->reciprocalBest != 0;
+        if (!(compiled == pruning)) {
+            why = path + " was compiled with pruning: " + compiled.describe();
+            return false;
+        }
+
+        const GraphCacheInput* inputs = section<GraphCacheInput>(h->inputsOffset);
+        for (uint64_t k = 0; k < h->inputCount; k++) {
+            GraphCacheInput now = statPairFile(inputs[k].i, inputs[k].j);
+            if (now.size != inputs[k].size || now.mtimeSec != inputs[k].mtimeSec ||
+                now.mtimeNsec != inputs[k].mtimeNsec) {
+                why = pairFileName(inputs[k].i, inputs[k].j) + " changed since " + path + " was compiled";
+                return false;
+            }
+        }
+
+        header = h;
+        return true;
+    }
+
+    const std::string& reason() const { return why; }
+
+    uint64_t geneCount() const { return header->geneCount; }
+    uint64_t adjacencyCount() const { return header->adjacencyCount; }
+    uint64_t edgeCount() const { return header->edgeCount; }
+
+    const uint64_t* nameOffsets() const { return section<uint64_t>(header->nameOffsetsOffset); }
+    const char* names() const { return section<char>(header->namesOffset); }
+
+    const int32_t* geneSpecies() const { return section<int32_t>(header->speciesOffset); }
+    const uint64_t* adjacencyOffsets() const { return section<uint64_t>(header->adjOffsetsOffset); }
+    const uint64_t* edgeOffsets() const { return section<uint64_t>(header->edgeOffsetsOffset); }
+    const uint32_t* neighbors() const { return section<uint32_t>(header->neighborsOffset); }
+    const double* weights() const { return section<double>(header->weightsOffset); }
+};
+
+#endif // GRAPHCACHE_H
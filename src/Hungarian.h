@@ -1,367 +1,274 @@
 #ifndef _HUNGARIAN_
 #define _HUNGARIAN_
 
-#define MAX 10000
-
-#include <list>
 #include <string>
 #include <vector>
-#include <queue>
+#include <climits>
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 
 using namespace std;
 
 
-class Hungarian
+/*
+ * Working arrays of solveAssignment. Kept by the caller and reused from
+ * problem to problem; they only grow, so solving many problems of
+ * similar size allocates nothing after the first.
+ */
+struct HungarianWorkspace
 {
-public:
-  int n;
-  vector<int> matchingX;
-  vector<int> matchingY;
-  vector<int>Lx;
-  vector<int>Ly;
-  vector<int>S;
-  vector<int>T;
-  vector<int>Nl_S;
-  list<int>augmentpath;
-  int totalweight;
-  typedef vector<int> row;
-  typedef vector<row> matrix;
-  matrix weight;
-  matrix El;
-
-  Hungarian ( ) 
+  vector<long long> u, v, minv;
+  vector<int> p, way;
+  vector<char> used;
+};
+
+/*
+ * One step of the shortest path search: relax the columns j in
+ * [first, last) that are not yet in the tree from row i0 (reached
+ * through column j0) and find the first unused column of least reduced
+ * cost. wi is the row of i0, read as weight 0 past column cols.
+ */
+inline void scanColumns(const int* wi, int cols, int first, int last, int j0, long long ui0,
+                        HungarianWorkspace& ws, long long& delta, int& j1)
+{
+  const long long* v = ws.v.data();
+  long long* minv = ws.minv.data();
+  int* way = ws.way.data();
+  const char* used = ws.used.data();
+  int j = first;
+
+#ifdef __AVX2__
+  // Four columns at a time; each lane keeps its first least column, and
+  // the lanes are reduced to the first least column overall
+  const int vectorEnd = min(last, cols+1);
+  if (vectorEnd - j >= 4)
   {
-    totalweight=0;
-    n = 0;
-  }
-
-  Hungarian( matrix w )
-  { 
-    totalweight = 0;
-    n = (int)w.size( );
-    Lx.clear();
-    Ly.clear();
-    El.clear();
-    S.clear();
-    T.clear();
-    Nl_S.clear();
- 
-    //	cout<<"Get weight matrix from parameter"<<endl;
-    for (int i=0; i<n; i++)
-      weight.push_back(w[i]);
-    
-
-    //	cout<<"Generate initial labelling L"<<endl;
-    for (int i=0; i<n; i++)
-      El.push_back(vector<int>(n,0));
-    for (int i=0; i<n; i++)
-      Ly.push_back( 0 );
-    for (int i=0; i<n; i++)
+    const __m256i base = _mm256_set1_epi64x(ui0);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i best = _mm256_set1_epi64x(LLONG_MAX);
+    __m256i bestAt = _mm256_set1_epi64x(-1);
+    __m256i at = _mm256_setr_epi64x(j, j+1, j+2, j+3);
+    const __m256i four = _mm256_set1_epi64x(4);
+    for (; j+4 <= vectorEnd; j+=4)
     {
-      int maxweight = 0;
-      for (int j=0; j<n; j++)
-      {
-	if (weight[i][j] > maxweight)
-	  maxweight = weight[i][j];
-      }	 
-      Lx.push_back(maxweight);
+      int usedBytes;
+      memcpy(&usedBytes, used+j, 4);
+      __m256i isUsed = _mm256_cmpgt_epi64(_mm256_cvtepi8_epi64(_mm_cvtsi32_si128(usedBytes)), zero);
+      __m256i w = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(wi+j-1)));
+      __m256i cur = _mm256_sub_epi64(zero, _mm256_add_epi64(_mm256_add_epi64(w, base),
+                                                            _mm256_loadu_si256((const __m256i*)(v+j))));
+      __m256i m = _mm256_loadu_si256((const __m256i*)(minv+j));
+      __m256i better = _mm256_andnot_si256(isUsed, _mm256_cmpgt_epi64(m, cur));
+      m = _mm256_blendv_epi8(m, cur, better);
+      _mm256_storeu_si256((__m256i*)(minv+j), m);
+      for (int bits = _mm256_movemask_pd(_mm256_castsi256_pd(better)); bits; bits &= bits-1)
+        way[j + __builtin_ctz(bits)] = j0;
+
+      __m256i candidate = _mm256_blendv_epi8(m, _mm256_set1_epi64x(LLONG_MAX), isUsed);
+      __m256i less = _mm256_cmpgt_epi64(best, candidate);
+      best = _mm256_blendv_epi8(best, candidate, less);
+      bestAt = _mm256_blendv_epi8(bestAt, at, less);
+      at = _mm256_add_epi64(at, four);
     }
-    
-    //	cout<<"Generate El, where El[x][y]=1 if Lx[x]+Ly[y] = weight[x][y], otherwise 0"<<endl;
-    for (int i=0; i<n; i++)
+    long long lane[4], laneAt[4];
+    _mm256_storeu_si256((__m256i*)lane, best);
+    _mm256_storeu_si256((__m256i*)laneAt, bestAt);
+    for (int k=0; k<4; k++)
     {
-      for (int j=0; j<n; j++)
+      if (laneAt[k] < 0)
+        continue;
+      if (lane[k] < delta || (lane[k] == delta && laneAt[k] < j1))
       {
-	if (Lx[i]+Ly[j] == weight[i][j])
-	  El[i][j] = 1;
+        delta = lane[k];
+        j1 = (int)laneAt[k];
       }
     }
+  }
+#endif
 
-    //	cout<<"Find the initial maximal matching in El"<<endl;
-    for (int i=0; i<n; i++)
-    {
-      matchingX.push_back(-1);
-      matchingY.push_back(-1);
-    }
-    
-    for (int i=0; i<n; i++)
+  for (; j<last; j++)
+  {
+    if (used[j])
+      continue;
+    long long cur = (j <= cols ? -(long long)wi[j-1] : 0) - ui0 - v[j];
+    if (cur < minv[j])
     {
-      for (int j=0; j<n; j++)
-      {
-	if (El[i][j] == 1 && matchingX[i] == -1 && matchingY[j] == -1)
-	{
-	  matchingX[i] = j;
-	  matchingY[j] = i;
-	  break;
-	}
-      }
+      minv[j] = cur;
+      way[j] = j0;
     }
-
-    //	cout<<"Main loop"<<endl;
-
-    while(1)
+    if (minv[j] < delta)
     {
-      int v = findFreevertex();
-      if (v == -1)
-	break; 
-      
-      //	cout<<"\t If mathcing is not perfect, pick a free vertex u from X, set S<-{u}, T<-empty"<<endl;
-      S.clear();
-      T.clear();
-      Nl_S.clear();
-      S.push_back (v);
-      for (int i=0; i<n; i++)
-      {
-	if (El[v][i] ==1)
-          Nl_S.push_back (i);
-      }
-
-      //	cout<<"\t Nl_S==T"<<endl;
-      if (isequal(Nl_S, T))
-	updateLabels( );
-
-      //	cout<<"\t Nl_S !=T"<<endl;
-      while (!isequal(Nl_S, T))
-      {
-	int y = diff(Nl_S, T);
-        if (isFreeinY(y))
-        {
-	  augment(v, y);
-	  break;
-        }
-        else
-        {
-	  int z = matchingY[y];
-	  uniqueInsert(S,z);
-          uniqueInsert(T,y);
-          for (int i=0; i<n; i++)
-          {
-            if (El[z][i] ==1)
-	      uniqueInsert(Nl_S,i);
-          }       
-	  if (isequal(Nl_S,T))
-            updateLabels( );
-	}
-      }
+      delta = minv[j];
+      j1 = j;
     }
-
-    //	cout<<"Matching is perfect, calculate total weight"<<endl;
-    for (int i=0; i<n; i++)
-      totalweight += weight[i][matchingX[i]];    
-  }
-
-
-  bool isFreeinY (int i)
-  {
-     if(matchingY[i] == -1 )
-        return true;
-     else
-        return false;
-
   }
+}
 
-  bool isFreeinX (int i)
+/*
+ * Move the potentials by delta: columns in the tree (and the rows they
+ * hold) tighten, the others' distances shrink
+ */
+inline void shiftPotentials(int columns, long long delta, HungarianWorkspace& ws)
+{
+  long long* u = ws.u.data();
+  long long* v = ws.v.data();
+  long long* minv = ws.minv.data();
+  const int* p = ws.p.data();
+  const char* used = ws.used.data();
+  int j = 0;
+
+#ifdef __AVX2__
+  const __m256i d = _mm256_set1_epi64x(delta);
+  const __m256i zero = _mm256_setzero_si256();
+  // Column 0, the virtual one, is always in the tree
+  u[p[0]] += delta;
+  v[0] -= delta;
+  for (j=1; j+4 <= columns+1; j+=4)
   {
-     if(matchingX[i] == -1 )
-        return true;
-     else
-        return false;
+    int usedBytes;
+    memcpy(&usedBytes, used+j, 4);
+    __m256i isUsed = _mm256_cmpgt_epi64(_mm256_cvtepi8_epi64(_mm_cvtsi32_si128(usedBytes)), zero);
+    __m256i vj = _mm256_loadu_si256((const __m256i*)(v+j));
+    _mm256_storeu_si256((__m256i*)(v+j), _mm256_sub_epi64(vj, _mm256_and_si256(isUsed, d)));
+    __m256i mj = _mm256_loadu_si256((const __m256i*)(minv+j));
+    _mm256_storeu_si256((__m256i*)(minv+j), _mm256_sub_epi64(mj, _mm256_andnot_si256(isUsed, d)));
+    for (int bits = _mm256_movemask_pd(_mm256_castsi256_pd(isUsed)); bits; bits &= bits-1)
+      u[p[j + __builtin_ctz(bits)]] += delta;
   }
+#endif
 
-  int findFreevertex( )
+  for (; j<=columns; j++)
   {
-    for (int i=0; i<n; i++)
+    if (used[j])
     {
-      if (isFreeinX (i))
-	return i;
+      u[p[j]] += delta;
+      v[j] -= delta;
     }
-    return -1;
+    else
+      minv[j] -= delta;
   }
- 
-  void updateLabels()
+}
+
+/*
+ * Maximum weight assignment of the rows of a rows x cols weight matrix
+ * to distinct columns, by shortest augmenting paths with dual potentials
+ * (Jonker-Volgenant style): rows are added one at a time, each along a
+ * shortest path in reduced costs found Dijkstra-style, for O(rows^2 cols)
+ * in all. Besides the real columns there may be spare ones of weight 0
+ * that are never stored; a row assigned to one is left unmatched. Needs
+ * rows <= cols + spare.
+ *
+ * w is the matrix in row-major order. Row i is matched to column
+ * matchingX[i], and column j to row matchingY[j] if matchingY is given;
+ * -1 means unmatched. Returns the total weight.
+ */
+inline int solveAssignment(const int* w, int rows, int cols, int spare,
+                           HungarianWorkspace& ws, int* matchingX, int* matchingY = 0)
+{
+  fill(matchingX, matchingX+rows, -1);
+  if (matchingY)
+    fill(matchingY, matchingY+cols, -1);
+  if (rows == 0)
+    return 0;
+
+  // Minimize the cost -weight. Index 0 is a virtual column that holds
+  // the row being added; potentials are 64-bit so that sums of large
+  // scores cannot overflow.
+  const int columns = cols + spare;
+  vector<long long>& u = ws.u;
+  vector<long long>& v = ws.v;
+  vector<long long>& minv = ws.minv;
+  vector<int>& p = ws.p;
+  vector<int>& way = ws.way;
+  vector<char>& used = ws.used;
+  u.assign(rows+1, 0);
+  v.assign(columns+1, 0);
+  minv.resize(columns+1);
+  p.assign(columns+1, 0);
+  way.assign(columns+1, 0);
+  used.resize(columns+1);
+
+  for (int i=1; i<=rows; i++)
   {
-    //	cout<<"\t\t Update Labels"<<endl;
-    int sizeS = (int)S.size();
-    int sizeT = (int)T.size();
+    p[0] = i;
+    int j0 = 0;
+    fill(minv.begin(), minv.end(), LLONG_MAX);
+    fill(used.begin(), used.end(), 0);
 
-    //calculate nT = ~T
-    vector<int>nT;
-    for (int i=0; i<n; i++)
+    //	cout<<"Grow the shortest path tree until it reaches a free column"<<endl;
+    do
     {
-      int j;
-      for ( j=0; j<sizeT; j++)
-      {
-	if (T[j]==i) 
-	  break;
-      }
-      if (j==sizeT)
-	nT.push_back( i );
-    }        
-    int sizenT = (int)nT.size();
-
-    //calculate alpha
-    int alpha = MAX;
-    for (int i=0; i<sizeS; i++)
+      used[j0] = 1;
+      int i0 = p[j0], j1 = 0;
+      long long delta = LLONG_MAX;
+      scanColumns(w + (size_t)(i0-1)*cols, cols, 1, columns+1, j0, u[i0], ws, delta, j1);
+      shiftPotentials(columns, delta, ws);
+      j0 = j1;
+    } while (p[j0] != 0);
+
+    //	cout<<"Augment along the path"<<endl;
+    do
     {
-      int x = S[i];
-      for (int j=0; j<sizenT; j++)
-      {
-	int y = nT[j];
-        int tmp = Lx[x] + Ly[y] -weight[x][y];
-	if (tmp < alpha)
-	  alpha = tmp;	
-      }	
-    }
-
-    //update labels
-    for (int i=0; i<sizeS; i++)
-    {
-      int x = S[i];
-      Lx[x] -= alpha;
-    }
-    for (int i=0; i<sizeT; i++)
-    {
-      int y = T[i];
-      Ly[y] += alpha;
-    }     
-
-    //update El
-    for (int i=0; i<n; i++)
-    {
-      for (int j=0; j<n; j++)
-      {
-        if(Lx[i]+Ly[j]==weight[i][j])
-	  El[i][j] = 1;
-	else
-	  El[i][j] = 0;
-      }
-    } 
-
-    //update Nl_S
-    Nl_S.clear( );
-    for (int i=0; i<sizeS; i++)
-
-    {
-      int x = S[i];
-      for (int j=0; j<n; j++)
-      {
-	if (El[x][j] == 1)
-	  uniqueInsert(Nl_S,j);
-      }
-    }
+      int j1 = way[j0];
+      p[j0] = p[j1];
+      j0 = j1;
+    } while (j0 != 0);
   }
 
-  void augment(int start, int end)
+  //	cout<<"Assignment is complete, calculate total weight"<<endl;
+  int totalweight = 0;
+  for (int j=1; j<=cols; j++)
   {
-    
-    queue<int>Q; //for BFS use
-    vector<int>parent(2*n,-1);
- 
-    //	cout<<"\t\t Find the augment path"<<endl;
-    DFS(parent, start, end);
-  
-    //	cout<<"\t\t Augmenting the matching"<<endl;
-    int b = end +n;
-    int a = parent[b];
-    matchingX[a] = b-n;
-    matchingY[b-n] = a;
-    while (a!=start)    
-    {
-      b = parent[a];
-      a = parent[b];
-      matchingX[a] = b-n;
-      matchingY[b-n] = a;       
-    }   
-  }
-  
-  void DFS(vector<int>& p, int s, int e)
-  {
-    vector<int>color(2*n,0);
-    DFS_visit( s,e, p, color );
+    if (p[j] == 0)
+      continue;
+    matchingX[p[j]-1] = j-1;
+    if (matchingY)
+      matchingY[j-1] = p[j]-1;
+    totalweight += w[(size_t)(p[j]-1)*cols + j-1];
   }
+  return totalweight;
+}
 
-  void DFS_visit(int s, int e,vector<int>& p, vector<int>&color)
-  {
-    color[s] = 1;
-    if(s == e+n)
-	return;
-    if (s<n)
-    {
-      for(int i =0; i<n; i++)
-      {
-	if(El[s][i] == 1)
-	{
-	  if(color[i+n] == 0)
-	  {
-	    p[i+n] = s;
-	    DFS_visit(i+n,e,p,color);
-	  }
-	  color[s] = 2;
-	}
-      }	
-    }
-    else
-    {
-      for(int i =0; i<n; i++)
-      {
-        if(matchingY[s-n] == i)
-        {
-          if(color[i] == 0)
-          {
-            p[i] = s;
-            DFS_visit(i,e,p,color);
-          }
-          color[s] = 2;
-        }
-      }
-
-    }
-  }
+/*
+ * The assignment of a matrix stored as a vector of rows; see
+ * solveAssignment
+ */
+class Hungarian
+{
+public:
+  int n;
+  int m;
+  vector<int> matchingX;
+  vector<int> matchingY;
+  int totalweight;
+  typedef vector<int> row;
+  typedef vector<row> matrix;
 
-  int diff(vector<int>a, vector<int>b)
-  {
-    for (int i=0; i<(int)a.size(); i++)
-    {
-      int j;
-      for (j=0; j<(int)b.size(); j++)
-      {
-	if (b[j] == a[i])
-	  break;
-      }
-      if (j==(int)b.size())
-	return a[i];
-    }
-    return -1;
-  }
-   
-  bool isequal( vector<int>a, vector<int>b) 
+  Hungarian ( ) 
   {
-    if (a.size() != b.size())
-      return false;
-    for (int i =0; i<(int)a.size(); i++)
-    {
-      int j;
-      for(j=0; j<(int)b.size(); j++)
-      {
-	if( a[i] == b[j] )
-	  break;
-      }
-      if (j==(int)b.size())
-	return false;
-    }
-    return true;
+    totalweight=0;
+    n = 0;
+    m = 0;
   }
 
-  void uniqueInsert (vector<int> & a, int i)
-  {
-    for (int j=0;j<(int)a.size();j++)
-    {
-      if (a[j]==i)
-	return;
-    }
-    a.push_back(i);
+  Hungarian( const matrix& w, int spare = 0 )
+  { 
+    n = (int)w.size( );
+    m = n > 0 ? (int)w[0].size( ) : 0;
+    matchingX.resize(n);
+    matchingY.resize(m);
+
+    vector<int> flat;
+    flat.reserve((size_t)n*m);
+    for (int i=0; i<n; i++)
+      flat.insert(flat.end(), w[i].begin(), w[i].end());
+    HungarianWorkspace ws;
+    totalweight = solveAssignment(flat.data(), n, m, spare, ws, matchingX.data(), matchingY.data());
   }
 
   void print()
@@ -0,0 +1,103 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * MappedFile - Read-only memory mapping of an input file
+ *
+ * Features:
+ * - RAII: the mapping is released when the object is destroyed
+ * - Move-only, so a mapping can be handed out of an I/O task via its future
+ * - Empty files are valid and map to an empty range
+ */
+class MappedFile {
+private:
+    const char* addr;
+    size_t len;
+    bool opened;
+
+    void release() {
+        if (addr != nullptr) {
+            munmap(const_cast<char*>(addr), len);
+        }
+        addr = nullptr;
+        len = 0;
+        opened = false;
+    }
+
+public:
+    MappedFile() : addr(nullptr), len(0), opened(false) {}
+
+    /**
+     * Map the whole file read-only
+     * @param path File to map; check is_open() for success
+     */
+    explicit MappedFile(const std::string& path)
+        : addr(nullptr), len(0), opened(false)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return;
+        }
+
+        len = (size_t)st.st_size;
+        if (len > 0) {
+            void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                len = 0;
+                return;
+            }
+            // Pair files are scanned front to back exactly once
+            madvise(p, len, MADV_SEQUENTIAL);
+            addr = static_cast<const char*>(p);
+        }
+        ::close(fd);
+        opened = true;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other)
+        : addr(other.addr), len(other.len), opened(other.opened)
+    {
+        other.addr = nullptr;
+        other.len = 0;
+        other.opened = false;
+    }
+
+    MappedFile& operator=(MappedFile&& other) {
+        if (this != &other) {
+            release();
+            addr = other.addr;
+            len = other.len;
+            opened = other.opened;
+            other.addr = nullptr;
+            other.len = 0;
+            other.opened = false;
+        }
+        return *this;
+    }
+
+    ~MappedFile() {
+        release();
+    }
+
+    bool is_open() const { return opened; }
+    const char* data() const { return addr; }
+    const char* end() const { return addr != nullptr ? addr + len : addr; }
+    size_t size() const { return len; }
+};
+
+#endif // MAPPEDFILE_H
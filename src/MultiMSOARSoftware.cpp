@@ -10,11 +10,23 @@
 #include <future>
 #include <chrono>
 #include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "GeneDictionary.h"
 #include "Hungarian.h"
+#include "SparseAssignment.h"
+#include "SmallAssignment.h"
 #include "TreeCentric.h"
 #include "NodeCentric.h"
 #include "TreeAnalysis.h"
 #include "ThreadPool.h"
+#include "OrthologGraph.h"
+#include "EdgePruning.h"
+#include "GraphCache.h"
+#include "GeneIndex.h"
+#include "BlockCompressed.h"
+#include "FamilyIndex.h"
+#include "ComponentIndex.h"
 
 using namespace std;
 
@@ -23,174 +35,608 @@ int S;
 string speciesTree;
 int maximumN;
 
-// Vertex and Adjacency list
-map<string,int> species;
-map<string, vector<string> > adjacency;
-map<pair<string,string>, double> edges;
+// Interned gene names (with the species of each gene)
+GeneDictionary genes;
+
+// Ortholog graph (CSR adjacency with edge scores), indexed by GeneId
+OrthologGraph graph;
+
+// Pairs dropped while loading (--min-score, --top-k, --reciprocal-best)
+PruneOptions pruning;
+PruneStats pruneStats;
 
 
 // Global results (thread-safe access via ResultAggregator)
-set<string> AllGeneBirth;
-set<string> AllGeneDuplication;
+set<GeneId> AllGeneBirth;
+set<GeneId> AllGeneDuplication;
 map<int, int> AllGeneLoss;
 
+// Pair files larger than this are parsed by several I/O workers
+const size_t PAIR_CHUNK_BYTES = 4 << 20;
+
+// Family names are resolved to ids in this many parallel slices
+const size_t FAMILY_RESOLVE_PARTS = 64;
+
 // Mutex for output file writing (used in parallel processing)
 mutex output_mutex;
 
-// Thread-local DFS - accepts local visited and group to avoid race conditions
-void DFS_Local(string cur,
-               map<string,int>& visited_local,
-               vector<string>& group_local,
-               const map<string, vector<string> >& adjacency)
+// Per-worker traversal state, reused by every component the worker
+// visits. A gene is visited when its mark equals the current epoch, so
+// starting a traversal is one increment instead of clearing the marks.
+struct TraversalScratch
+{
+	vector<uint32_t> mark;
+	uint32_t epoch;
+	vector<GeneId> stack;
+	vector<GeneId> group;
+	vector<vector<GeneId> > runGroups;   // The groups of a run of components
+
+	TraversalScratch() : epoch(0) {}
+};
+
+thread_local TraversalScratch traversalScratch;
+
+// Thread-local DFS with an explicit stack; appends the component of start
+// to group_local
+void DFS_Local(GeneId start,
+               vector<GeneId>& group_local,
+               const OrthologGraph& graph,
+               TraversalScratch& scratch)
 {
-	group_local.push_back(cur);
-	visited_local[cur]=1;
+	if(scratch.mark.size()<graph.size()) scratch.mark.resize(graph.size(), 0);
+	if(++scratch.epoch==0)
+	{
+		fill(scratch.mark.begin(), scratch.mark.end(), 0);
+		scratch.epoch=1;
+	}
+	const uint32_t epoch=scratch.epoch;
 
-	// Check if gene has adjacency entries before accessing
-	auto it = adjacency.find(cur);
-	if(it != adjacency.end())
+	vector<GeneId>& stack=scratch.stack;
+	stack.clear();
+	stack.push_back(start);
+	scratch.mark[start]=epoch;
+	while(!stack.empty())
 	{
-		for(int i=0; i<it->second.size(); i++)
+		GeneId cur=stack.back(); stack.pop_back();
+		group_local.push_back(cur);
+		for(const GeneId* next=graph.begin(cur); next!=graph.end(cur); next++)
 		{
-			string next=it->second[i];
-			if(visited_local.count(next)==0)
-				DFS_Local(next, visited_local, group_local, adjacency);
+			if(scratch.mark[*next]!=epoch)
+			{
+				scratch.mark[*next]=epoch;
+				stack.push_back(*next);
+			}
 		}
 	}
 }
 
-// Partition each group into N layers (thread-safe version)
-void Partition_Local(const vector<string>& group_local,
-                     vector<string>& AllTrees_local,
-                     vector<vector<string> >& AllTreeGeneName_local,
-                     const map<string,int>& species,
-                     const map<pair<string,string>, double>& edges,
-                     const string& speciesTree,
-                     int S)
+// Edge of a group's local subgraph; genes are numbered by their position
+// in the sorted group
+struct LocalEdge
 {
-	vector<vector<vector<string> > > v(S);
-
-	for(int i=0; i<group_local.size(); i++)
+	uint32_t a, b;
+	int weight;
+};
+
+// List every edge among the genes of a sorted group once. A group is a
+// whole component, so every neighbor of a group gene is in the group.
+void ExtractLocalEdges(const vector<GeneId>& group_local,
+                       const OrthologGraph& graph,
+                       vector<LocalEdge>& edges_local)
+{
+	for(uint32_t a=0; a<group_local.size(); a++)
 	{
-		// Check if gene has species mapping
-		auto sp_it = species.find(group_local[i]);
-		if(sp_it == species.end())
+		GeneId gene=group_local[a];
+		const double* weight=graph.upperWeights(gene);
+		vector<GeneId>::const_iterator from=group_local.begin()+a+1;
+		for(const GeneId* next=graph.upperBegin(gene); next!=graph.end(gene); next++, weight++)
 		{
-			// Gene not in species map - skip it
-			continue;
+			// A gene paired with itself never spans two layers
+			if(*next==gene) continue;
+			from=lower_bound(from, group_local.end(), *next);
+			if(from==group_local.end() or *from!=*next) continue;
+			LocalEdge e={ a, (uint32_t)(from-group_local.begin()), (int)*weight };
+			edges_local.push_back(e);
 		}
-		int sp = sp_it->second;
-		vector<string> tmp;
-		tmp.push_back(group_local[i]);
-		v[sp].push_back(tmp);
 	}
-	
-	// N: the number of layers
-	int N=0;
-	for(int i=0; i<S; i++) N=max(N, (int)(v[i].size()));
+}
 
-	//cout<<"N="<<N<<endl;
+// One layer of a subtree during Partition_Local: a list of local gene
+// numbers linked through a per-group next array
+struct LayerList
+{
+	uint32_t head, tail;
+
+	LayerList() : head(NO_GENE), tail(NO_GENE) {}
+};
+
+// Partitions with at least this many layers merge disjoint subtrees of
+// the species tree in parallel
+const int PARALLEL_MERGE_LAYERS = 64;
+
+// Merges whose score matrix has at most this share of non-zero entries
+// use the sparse assignment
+const double SPARSE_MERGE_DENSITY = 0.02;
+
+// Families whose components hold at least this many genes in all are
+// processed in runs of components, one run per subtask
+const size_t SPLIT_FAMILY_GENES = 256;
+
+// A run holds at most this many consecutive components of a family; its
+// components are partitioned together, so their tiny merges are solved in
+// batches
+const size_t BATCH_COMPONENTS = 64;
+
+// Tiny merges of one shape are solved by the batched kernels once at
+// least this many are queued; fewer are cheaper one at a time
+const int MIN_BATCH_MERGES = 3;
+
+// Layers of one group while Partition_Local merges them up the species
+// tree. Disjoint subtrees own disjoint list slots, genes and score
+// blocks, so their merges may run concurrently.
+struct PartitionState
+{
+	int N;
+	vector<LayerList> lists;   // Leaf k owns lists[k*N, (k+1)*N)
+	vector<uint32_t> next;
+	vector<int> layer;         // Layer of every gene within its subtree
+
+	// Internal nodes in postfix order: children (an internal node, or
+	// leaf k as -1-k), the first leaf of the subtree, and the score block
+	// of the merge; the roots of the merge tree
+	vector<int> left, right, firstLeaf;
+	vector<vector<LocalEdge> > blocks;
+	vector<int> roots;
+};
+
+// Working arrays of one worker's merges. A merge only uses them after
+// its subtrees are merged, and nothing in between can start another
+// merge on the same thread, so one set per thread serves them all and
+// the matching allocates nothing once the arrays have grown.
+struct MergeWorkspace
+{
+	vector<int> real1, real2, pos1, pos2, target;
+	vector<int> matrix, matching;
+	vector<SparseEntry> entries;
+	HungarianWorkspace hungarian;
+	SparseAssignment sparse;
+
+	// Lockstep merges of a run: the merges waiting for each R x C shape,
+	// and the interleaved matrices and matchings of one batch
+	vector<vector<PartitionState*> > batchQueues;
+	vector<int> batchMatrix, batchMatching;
+
+	// The states of a run of components, and those merged in lockstep
+	vector<PartitionState> runStates;
+	vector<PartitionState*> lockstep;
+};
+
+thread_local MergeWorkspace mergeWorkspace;
+
+// The two sides of a merge whose subtrees are merged. Only their real
+// (non-empty) layers take part in the matching, listed in the workspace;
+// the empty ones are the dummy vertices of the padding. The smaller side
+// gives the rows of a rectangular score matrix.
+struct MergeShape
+{
+	LayerList* v1;
+	LayerList* v2;
+	int R, C;
+	bool transposed;
+};
+
+void ShapeMerge(PartitionState& state, int node, MergeWorkspace& ws, MergeShape& shape)
+{
+	const int N=state.N;
+	int l=state.left[node], r=state.right[node];
+	shape.v1=&state.lists[(l>=0 ? state.firstLeaf[l] : -1-l)*N];
+	shape.v2=&state.lists[(r>=0 ? state.firstLeaf[r] : -1-r)*N];
+
+	vector<int>& real1=ws.real1;
+	vector<int>& real2=ws.real2;
+	real1.clear();
+	real2.clear();
+	ws.pos1.assign(N, -1);
+	ws.pos2.assign(N, -1);
+	for(int j=0; j<N; j++)
+	{
+		if(shape.v1[j].head!=NO_GENE) { ws.pos1[j]=real1.size(); real1.push_back(j); }
+		if(shape.v2[j].head!=NO_GENE) { ws.pos2[j]=real2.size(); real2.push_back(j); }
+	}
+	shape.transposed=real1.size()>real2.size();
+	shape.R=min(real1.size(), real2.size());
+	shape.C=max(real1.size(), real2.size());
+}
 
-	// Pad each species in a group with dummy vertices
-	for(int i=0; i<S; i++)
+bool HasNegativeScore(const vector<LocalEdge>& block)
+{
+	for(size_t e=0; e<block.size(); e++)
+		if(block[e].weight<0) return true;
+	return false;
+}
+
+// Add up the score block of a merge into a zeroed R x C matrix, entry
+// (j, k) at matrix[(j*C+k)*stride]
+void FillMergeMatrix(const PartitionState& state, int node, const MergeWorkspace& ws,
+                     const MergeShape& shape, int* matrix, size_t stride)
+{
+	// Calculate the added weight for an edge in Bipartite Graph
+	const vector<LocalEdge>& block=state.blocks[node];
+	for(size_t e=0; e<block.size(); e++)
 	{
-		vector<string> dummy;
-		dummy.push_back("");
+		int j=ws.pos1[state.layer[block[e].a]], k=ws.pos2[state.layer[block[e].b]];
+		if(shape.transposed) swap(j, k);
+		matrix[((size_t)j*shape.C+k)*stride]+=block[e].weight;
+	}
+}
 
-		for(int j=v[i].size(); j<N; j++) 
-			v[i].push_back(dummy);
+// Append the layers of v2 to the layers of v1 they are matched with: row i
+// of the score matrix got column matching[i*stride] (or -1). Without a
+// matching (no edge between the sides) any pairing of real layers is
+// optimal, and they pair in order.
+void FinishMerge(PartitionState& state, MergeWorkspace& ws, const MergeShape& shape,
+                 const int* matching, size_t stride)
+{
+	const int N=state.N;
+	LayerList* v1=shape.v1;
+	LayerList* v2=shape.v2;
+	const vector<int>& real1=ws.real1;
+	const vector<int>& real2=ws.real2;
+
+	// target[k]: the layer of v1 that layer k of v2 is merged into
+	vector<int>& target=ws.target;
+	target.assign(N, -1);
+	if(matching)
+	{
+		const vector<int>& rows=shape.transposed ? real2 : real1;
+		const vector<int>& cols=shape.transposed ? real1 : real2;
+		for(int i=0; i<shape.R; i++)
+		{
+			int c=matching[i*stride];
+			if(c<0) continue;
+			if(shape.transposed) target[rows[i]]=cols[c];
+			else target[cols[c]]=rows[i];
+		}
+	}
+	else
+	{
+		for(size_t i=0; i<min(real1.size(), real2.size()); i++) target[real2[i]]=real1[i];
 	}
 
-	//////////////////////////////////
-	
-	vector<vector<vector<string> > > stack;
+	// Unmatched real layers of v2 fill the empty layers of v1, in order
+	for(int k=0, j=0; k<N; k++)
+	{
+		if(v2[k].head==NO_GENE or target[k]>=0) continue;
+		while(v1[j].head!=NO_GENE) j++;
+		target[k]=j++;
+	}
 
-	int index=0;
+	// Merge the vertices after matching: append each matched list
+	for(int k=0; k<N; k++)
+	{
+		const LayerList& from=v2[k];
+		if(from.head==NO_GENE) continue;
+		int j=target[k];
+		for(uint32_t g=from.head; g!=NO_GENE; g=state.next[g]) state.layer[g]=j;
+		if(v1[j].head==NO_GENE) v1[j].head=from.head;
+		else state.next[v1[j].tail]=from.head;
+		v1[j].tail=from.tail;
+	}
+}
+
+// Merge the two subtrees of an internal node once theirs are merged
+void MergeNode_Local(PartitionState& state, int node, MergeWorkspace& ws, const MergeShape& shape)
+{
+	const vector<LocalEdge>& block=state.blocks[node];
+	if(block.empty())
+	{
+		FinishMerge(state, ws, shape, nullptr, 1);
+		return;
+	}
 
-	for(int i=0; i<speciesTree.size(); i++)
+	const int N=state.N, R=shape.R, C=shape.C;
+	const bool negative=HasNegativeScore(block);
+	vector<int>& matching=ws.matching;
+	matching.resize(R);
+	if(not negative and C>smallassignment::MAX_COLUMNS and block.size()<=SPARSE_MERGE_DENSITY*R*C)
 	{
-		if(speciesTree[i]!='N')
+		// Mostly zero: solve on the non-zero entries only
+		vector<SparseEntry>& entries=ws.entries;
+		entries.clear();
+		for(size_t e=0; e<block.size(); e++)
+		{
+			SparseEntry entry={ ws.pos1[state.layer[block[e].a]], ws.pos2[state.layer[block[e].b]], block[e].weight };
+			if(shape.transposed) swap(entry.row, entry.col);
+			entries.push_back(entry);
+		}
+		sort(entries.begin(), entries.end());
+		size_t kept=0;
+		for(size_t e=0; e<entries.size(); e++)
 		{
-			stack.push_back(v[index++]);
+			if(kept>0 and entries[kept-1].row==entries[e].row and entries[kept-1].col==entries[e].col)
+				entries[kept-1].weight+=entries[e].weight;
+			else entries[kept++]=entries[e];
 		}
+		entries.resize(kept);
+		entries.erase(remove_if(entries.begin(), entries.end(),
+		                        [](const SparseEntry& entry) { return entry.weight==0; }), entries.end());
+		ws.sparse.solve(R, C, entries, matching.data());
+	}
+	else
+	{
+		// Row-major R x C score matrix
+		vector<int>& matrix=ws.matrix;
+		matrix.assign((size_t)R*C, 0);
+		FillMergeMatrix(state, node, ws, shape, matrix.data(), 1);
+
+		if(not negative and C<=smallassignment::MAX_COLUMNS)
+			smallassignment::assign(matrix.data(), R, C, matching.data());
 		else
 		{
-			vector<vector<string> > v2=stack.back(); stack.pop_back();
-			vector<vector<string> > v1=stack.back(); stack.pop_back();
+			// Run the Hungarian maximum matching algorithm for weighted
+			// bipartite graph. A real row may go to a dummy column
+			// instead, as long as dummies remain; that only pays off
+			// for negative scores.
+			int spare=negative ? min(R, N-C) : 0;
+			//cout<<"Running Hungarian ..."<<endl;
+			solveAssignment(matrix.data(), R, C, spare, ws.hungarian, matching.data());
+			//cout<<"Hungarian Done."<<endl;
+		}
+	}
+	FinishMerge(state, ws, shape, matching.data(), 1);
+}
 
-			vector<vector<int> > matrix(N, vector<int> (N) );
+// Merge the two subtrees of an internal node, after merging theirs
+void MergeSubtree_Local(PartitionState& state, int node, ThreadPool* pool)
+{
+	int l=state.left[node], r=state.right[node];
 
-			// Calculate the added weight for an edge in Bipartite Graph
-			for(int j=0; j<N; j++) for(int k=0; k<N; k++) matrix[j][k]=0;
+	// Above the threshold the left subtree is merged by a subtask while
+	// this thread does the right one
+	future<void> pending;
+	bool spawned=false;
+	if(pool and state.N>=PARALLEL_MERGE_LAYERS and l>=0 and r>=0)
+	{
+		pending=pool->enqueueSubtask([&state, l, pool]() { MergeSubtree_Local(state, l, pool); });
+		spawned=true;
+	}
+	else if(l>=0) MergeSubtree_Local(state, l, pool);
+	if(r>=0) MergeSubtree_Local(state, r, pool);
+	if(spawned)
+	{
+		pool->helpUntilReady(pending);
+		pending.get();
+	}
+
+	MergeWorkspace& ws=mergeWorkspace;
+	MergeShape shape;
+	ShapeMerge(state, node, ws, shape);
+	MergeNode_Local(state, node, ws, shape);
+}
 
-			for(int j=0; j<N; j++) for(int k=0; k<N; k++)
+// Merge several groups in lockstep. All groups share the merge tree, and
+// merge m of a group only waits on its own earlier merges, so the groups
+// take merge m together: the tiny dense merges are queued by shape and
+// solved LANES at a time by the batched kernels, the others are merged on
+// the spot. Runs on the calling thread only.
+void MergeBatch_Local(const vector<PartitionState*>& states)
+{
+	using namespace smallassignment;
+	if(states.empty()) return;
+
+	MergeWorkspace& ws=mergeWorkspace;
+	const int SHAPES=(MAX_COLUMNS+1)*(MAX_COLUMNS+1);
+	vector<vector<PartitionState*> >& queued=ws.batchQueues;
+	if(queued.size()<SHAPES) queued.resize(SHAPES);
+	vector<int>& matrix=ws.batchMatrix;
+	vector<int>& matching=ws.batchMatching;
+	MergeShape shape;
+	const int merges=states[0]->left.size();
+	for(int m=0; m<merges; m++)
+	{
+		for(size_t s=0; s<states.size(); s++)
+		{
+			ShapeMerge(*states[s], m, ws, shape);
+			const vector<LocalEdge>& block=states[s]->blocks[m];
+			if(block.empty() or shape.C>MAX_COLUMNS or HasNegativeScore(block))
+				MergeNode_Local(*states[s], m, ws, shape);
+			else
+				queued[shape.R*(MAX_COLUMNS+1)+shape.C].push_back(states[s]);
+		}
+
+		for(int q=0; q<SHAPES; q++)
+		{
+			vector<PartitionState*>& waiting=queued[q];
+			const int R=q/(MAX_COLUMNS+1), C=q%(MAX_COLUMNS+1);
+			size_t first=0;
+			for(; first+MIN_BATCH_MERGES<=waiting.size(); first+=LANES)
 			{
-				for(int jj=0; jj<v1[j].size(); jj++) for(int kk=0; kk<v2[k].size(); kk++)
+				// Interleave up to LANES matrices; unused lanes solve zeros
+				size_t count=min((size_t)LANES, waiting.size()-first);
+				matrix.assign((size_t)R*C*LANES, 0);
+				for(size_t lane=0; lane<count; lane++)
+				{
+					ShapeMerge(*waiting[first+lane], m, ws, shape);
+					FillMergeMatrix(*waiting[first+lane], m, ws, shape, matrix.data()+lane, LANES);
+				}
+				matching.resize((size_t)R*LANES);
+				assignBatch(matrix.data(), R, C, matching.data());
+				for(size_t lane=0; lane<count; lane++)
 				{
-					string gene1=v1[j][jj];
-					string gene2=v2[k][kk];
-					if(gene1=="" or gene2=="") matrix[j][k]+=0;
-					auto edge_key = make_pair(gene1, gene2);
-					if(edges.count(edge_key)) matrix[j][k]+=(int)edges.at(edge_key);
+					ShapeMerge(*waiting[first+lane], m, ws, shape);
+					FinishMerge(*waiting[first+lane], ws, shape, matching.data()+lane, LANES);
 				}
 			}
-
-			// Run the Hungarian maximum matching algorithm for weighted bipartite graph
-			//cout<<"Running Hungarian ..."<<endl;
-			Hungarian H(matrix);
-			//cout<<"Hungarian Done."<<endl;
-
-			// Merge the vertices after matching
-			for(int j=0; j<N; j++)
+			for(; first<waiting.size(); first++)
 			{
-				int p=H.matchingX[j];
-				for(int k=0; k<v2[p].size(); k++)
-					v1[j].push_back(v2[p][k]);
+				ShapeMerge(*waiting[first], m, ws, shape);
+				MergeNode_Local(*waiting[first], m, ws, shape);
 			}
+			waiting.clear();
+		}
+	}
+}
 
-			stack.push_back(v1);
+// Set up the merge tree, score blocks and leaf layers of a group. The
+// state may be one a previous group used; its arrays keep their capacity.
+void PreparePartition_Local(const vector<GeneId>& group_local,
+                            const GeneDictionary& genes,
+                            const OrthologGraph& graph,
+                            const string& speciesTree,
+                            int S,
+                            PartitionState& state)
+{
+	// Layers hold local gene numbers (positions in group_local); NO_GENE
+	// is a dummy vertex
+	vector<LocalEdge> edges_local;
+	ExtractLocalEdges(group_local, graph, edges_local);
+
+	// The merge tree, and the internal node where the subtrees of two
+	// species meet. Leaf k is species k, so the smaller species is always
+	// in the left subtree.
+	vector<vector<int> > meet(S, vector<int>(S, -1));
+	vector<int>& roots=state.roots;
+	state.left.clear();
+	state.right.clear();
+	state.firstLeaf.clear();
+	roots.clear();
+	{
+		vector<vector<int> > clades;
+		int leaf=0;
+		for(int i=0; i<speciesTree.size(); i++)
+		{
+			if(speciesTree[i]!='N')
+			{
+				roots.push_back(-1-leaf);
+				clades.push_back(vector<int>(1, leaf++));
+				continue;
+			}
+			int node=state.left.size();
+			state.right.push_back(roots.back()); roots.pop_back();
+			state.left.push_back(roots.back());
+			roots.back()=node;
+
+			vector<int> right=clades.back(); clades.pop_back();
+			vector<int>& left=clades.back();
+			state.firstLeaf.push_back(left[0]);
+			for(int a=0; a<left.size(); a++) for(int b=0; b<right.size(); b++)
+				if(left[a]<S and right[b]<S) meet[left[a]][right[b]]=meet[right[b]][left[a]]=node;
+			left.insert(left.end(), right.begin(), right.end());
 		}
 	}
-	
-	// Cout the partition for each group
-	//cout<<N<<" layers: "<<endl;
-	vector<string> trees(N, string(S,'0'));
-	vector<vector<string> > treeGeneName(N, vector<string> (S));
 
-	for(int i=0; i<N; i++) for(int j=0; j<S; j++) treeGeneName[i][j]="";
+	// Score blocks: the edges between each pair of species, filed under
+	// the merge where their species meet, smaller species first. A merge
+	// adds up exactly its own block, each entry at the layers its two
+	// genes have been matched into by then.
+	for(size_t m=0; m<state.blocks.size(); m++) state.blocks[m].clear();
+	state.blocks.resize(state.left.size());
+	for(size_t e=0; e<edges_local.size(); e++)
+	{
+		LocalEdge edge=edges_local[e];
+		int sa=genes.speciesOf(group_local[edge.a]), sb=genes.speciesOf(group_local[edge.b]);
+		if(sa==sb or meet[sa][sb]<0) continue;
+		if(sb<sa) swap(edge.a, edge.b);
+		state.blocks[meet[sa][sb]].push_back(edge);
+	}
+	vector<LocalEdge>().swap(edges_local);
+
+	// N: the number of layers
+	vector<int> count(S, 0);
+	for(int i=0; i<group_local.size(); i++) count[genes.speciesOf(group_local[i])]++;
+	int N=0;
+	for(int i=0; i<S; i++) N=max(N, count[i]);
+	state.N=N;
+
+	//cout<<"N="<<N<<endl;
+
+	// Leaf k's genes go one per list, in group order; empty lists stand
+	// in for the dummy vertices the species is padded with
+	state.lists.assign(S*N, LayerList());
+	state.next.assign(group_local.size(), NO_GENE);
+	state.layer.resize(group_local.size());
+	fill(count.begin(), count.end(), 0);
+	for(uint32_t i=0; i<group_local.size(); i++)
+	{
+		int sp = genes.speciesOf(group_local[i]);
+		state.lists[sp*N+count[sp]].head=i;
+		state.lists[sp*N+count[sp]].tail=i;
+		state.layer[i]=count[sp]++;
+	}
+}
+
+// Turn the merged layers of a group into its trees
+void EmitPartition_Local(const PartitionState& state,
+                         const vector<GeneId>& group_local,
+                         vector<string>& AllTrees_local,
+                         vector<vector<GeneId> >& AllTreeGeneName_local,
+                         const GeneDictionary& genes,
+                         const string& speciesTree,
+                         int S)
+{
+	const int N=state.N;
+	const vector<int>& roots=state.roots;
+
+	// Cout the partition for each group; the tree string of a layer is
+	// the postfix species tree with each leaf replaced by its species' bit
+	//cout<<N<<" layers: "<<endl;
+	const LayerList* root=nullptr;
+	if(!roots.empty()) root=&state.lists[(roots[0]>=0 ? state.firstLeaf[roots[0]] : -1-roots[0])*N];
+	vector<char> bits(S);
 
 	for(int i=0; i<N; i++)
 	{
-		for(int j=0; j<stack[0][i].size(); j++)
+		vector<GeneId> treeGeneName(S, NO_GENE);
+		fill(bits.begin(), bits.end(), '0');
+		if(root) for(uint32_t g=root[i].head; g!=NO_GENE; g=state.next[g])
 		{
-			if(stack[0][i][j]!="")
-			{
-				auto sp_it = species.find(stack[0][i][j]);
-				if(sp_it != species.end())
-				{
-					int sp = sp_it->second;
-					trees[i][sp]='1';
-					treeGeneName[i][sp]=stack[0][i][j];
-				}
-			}
+			GeneId gene = group_local[g];
+			int sp = genes.speciesOf(gene);
+			bits[sp]='1';
+			treeGeneName[sp]=gene;
 		}
-		for(int j=0; j<speciesTree.size(); j++) if(speciesTree[j]=='N')
-			trees[i]=trees[i].substr(0, j)+"N"+trees[i].substr(j);
-		//cout<<trees[i]<<endl;
+
+		string tree;
+		tree.reserve(speciesTree.size()+S);
+		int leaf=0;
+		for(int j=0; j<speciesTree.size(); j++)
+			tree+=(speciesTree[j]=='N' or leaf>=S) ? speciesTree[j] : bits[leaf++];
+		tree.append(bits.begin()+leaf, bits.end());
+		//cout<<tree<<endl;
+
+		// Store the results in local storage (thread-safe)
+		AllTrees_local.push_back(tree);
+		AllTreeGeneName_local.push_back(treeGeneName);
 	}
+}
+
+// Partition each group into N layers (thread-safe version)
+void Partition_Local(const vector<GeneId>& group_local,
+                     vector<string>& AllTrees_local,
+                     vector<vector<GeneId> >& AllTreeGeneName_local,
+                     const GeneDictionary& genes,
+                     const OrthologGraph& graph,
+                     const string& speciesTree,
+                     int S,
+                     ThreadPool* pool)
+{
+	PartitionState state;
+	PreparePartition_Local(group_local, genes, graph, speciesTree, S, state);
 
-	// Store the results in local storage (thread-safe)
-	for(int i=0; i<N; i++) AllTrees_local.push_back(trees[i]);
-	for(int i=0; i<N; i++) AllTreeGeneName_local.push_back(treeGeneName[i]);
+	for(size_t i=0; i<state.roots.size(); i++)
+		if(state.roots[i]>=0) MergeSubtree_Local(state, state.roots[i], pool);
+
+	EmitPartition_Local(state, group_local, AllTrees_local, AllTreeGeneName_local, genes, speciesTree, S);
 }
 
 // Thread-safe TreeLabeling - accumulates results locally
 void TreeLabeling_Local(const vector<string>& AllTrees_local,
-                        const vector<vector<string> >& AllTreeGeneName_local,
-                        set<string>& GeneBirth_local,
-                        set<string>& GeneDuplication_local,
+                        const vector<vector<GeneId> >& AllTreeGeneName_local,
+                        set<GeneId>& GeneBirth_local,
+                        set<GeneId>& GeneDuplication_local,
                         map<int, int>& GeneLoss_local,
                         stringstream& orthoGroupBuffer,
+                        const GeneDictionary& genes,
                         const string& speciesTree)
 {
 	// Decide which labeling algorithm to use (NodeCentric or TreeCentric)
@@ -226,7 +672,7 @@ void TreeLabeling_Local(const vector<string>& AllTrees_local,
 	//ta.printDetailedAnalysis();
 
 	// Write to buffer instead of file (for thread safety)
-	ta.printOrthoGroups_Buffer(orthoGroupBuffer);
+	ta.printOrthoGroups_Buffer(orthoGroupBuffer, genes);
 
 	ta.printGeneInfo();
 
@@ -237,49 +683,244 @@ void TreeLabeling_Local(const vector<string>& AllTrees_local,
 	//cout<<"********************************************************"<<endl;
 }
 
+// Partition and label the connected component of one gene
+void ProcessComponent_Local(GeneId start,
+                            const GeneDictionary& genes,
+                            const OrthologGraph& graph,
+                            const string& speciesTree,
+                            int S,
+                            ThreadPool* pool,
+                            set<GeneId>& GeneBirth_local,
+                            set<GeneId>& GeneDuplication_local,
+                            map<int, int>& GeneLoss_local,
+                            stringstream& orthoGroupBuffer)
+{
+	TraversalScratch& scratch=traversalScratch;
+
+	// The group buffer is borrowed from the worker's scratch and handed
+	// back at the end, keeping its capacity for the next component
+	vector<GeneId> group_local;
+	group_local.swap(scratch.group);
+	group_local.clear();
+	vector<string> AllTrees_local;
+	vector<vector<GeneId> > AllTreeGeneName_local;
+
+	// Perform DFS to find connected components
+	DFS_Local(start, group_local, graph, scratch);
+
+	// Layers start in gene order, not traversal order, so equal-weight
+	// matchings are broken the same way however the graph is stored
+	sort(group_local.begin(), group_local.end());
+
+	// Partition the group into layers
+	Partition_Local(group_local, AllTrees_local, AllTreeGeneName_local,
+	               genes, graph, speciesTree, S, pool);
+
+	// Perform tree labeling and analysis
+	TreeLabeling_Local(AllTrees_local, AllTreeGeneName_local,
+	                  GeneBirth_local, GeneDuplication_local, GeneLoss_local,
+	                  orthoGroupBuffer, genes, speciesTree);
+
+	group_local.swap(scratch.group);
+}
+
+// Partition a run of components together; component c's trees go to
+// AllTrees_run[c] and AllTreeGeneName_run[c]. Groups of at least
+// PARALLEL_MERGE_LAYERS layers keep their parallel merges, the others are
+// merged in lockstep.
+void PartitionComponents_Local(const GeneId* starts,
+                               size_t count,
+                               const GeneDictionary& genes,
+                               const OrthologGraph& graph,
+                               const string& speciesTree,
+                               int S,
+                               ThreadPool* pool,
+                               vector<vector<string> >& AllTrees_run,
+                               vector<vector<vector<GeneId> > >& AllTreeGeneName_run)
+{
+	// The run storage is borrowed from the worker and handed back at the
+	// end, keeping its capacity for the next run. A parallel merge may
+	// help with another run meanwhile; that one finds it empty.
+	vector<vector<GeneId> > groups;
+	vector<PartitionState> states;
+	vector<PartitionState*> lockstep;
+	groups.swap(traversalScratch.runGroups);
+	states.swap(mergeWorkspace.runStates);
+	lockstep.swap(mergeWorkspace.lockstep);
+	if(groups.size()<count) groups.resize(count);
+	if(states.size()<count) states.resize(count);
+	lockstep.clear();
+	for(size_t c=0; c<count; c++)
+	{
+		groups[c].clear();
+		DFS_Local(starts[c], groups[c], graph, traversalScratch);
+		sort(groups[c].begin(), groups[c].end());
+		PartitionState& state=states[c];
+		PreparePartition_Local(groups[c], genes, graph, speciesTree, S, state);
+		if(pool and state.N>=PARALLEL_MERGE_LAYERS)
+		{
+			for(size_t i=0; i<state.roots.size(); i++)
+				if(state.roots[i]>=0) MergeSubtree_Local(state, state.roots[i], pool);
+		}
+		else lockstep.push_back(&state);
+	}
+	MergeBatch_Local(lockstep);
+
+	AllTrees_run.assign(count, vector<string>());
+	AllTreeGeneName_run.assign(count, vector<vector<GeneId> >());
+	for(size_t c=0; c<count; c++)
+		EmitPartition_Local(states[c], groups[c], AllTrees_run[c], AllTreeGeneName_run[c],
+		                    genes, speciesTree, S);
+
+	groups.swap(traversalScratch.runGroups);
+	states.swap(mergeWorkspace.runStates);
+	lockstep.swap(mergeWorkspace.lockstep);
+}
+
 /**
  * Process a single gene family (thread-safe worker function)
  * This function is called by the thread pool for parallel processing
  */
-void processFamilyTask(int family_id,
-                       const set<string>& family_genes,
-                       const map<string,int>& species,
-                       const map<string, vector<string> >& adjacency,
-                       const map<pair<string,string>, double>& edges,
+void processFamilyTask(const FamilyIndex& families,
+                       size_t family_id,
+                       ComponentIndex& components,
+                       const GeneDictionary& genes,
+                       const OrthologGraph& graph,
                        const string& speciesTree,
                        int S,
+                       ThreadPool* pool,
                        ResultAggregator& aggregator,
                        ofstream& orthoGroupOut)
 {
 	// Thread-local state
-	map<string,int> visited_local;
-	set<string> GeneBirth_local;
-	set<string> GeneDuplication_local;
+	set<GeneId> GeneBirth_local;
+	set<GeneId> GeneDuplication_local;
 	map<int, int> GeneLoss_local;
 	stringstream orthoGroupBuffer;
 
-	// Process each gene in the family
-	for(set<string>::const_iterator j=family_genes.begin(); j!=family_genes.end(); j++)
+	// Components reached by the family, in order of their first family
+	// gene, with that gene
+	unordered_set<GeneId> seen_local;
+	vector<GeneId> starts, reached;
+	size_t reachedGenes=0;
+	for(const GeneId* j=families.begin(family_id); j!=families.end(family_id); j++)
 	{
-		if(visited_local.count(*j)==0)
+		GeneId component = components.componentOf(*j);
+		if(!seen_local.insert(component).second) continue;
+		starts.push_back(*j);
+		reached.push_back(component);
+		reachedGenes+=components.componentSize(component);
+	}
+
+	// The family's own components (those no other family reaches) go in
+	// runs of consecutive ones that are partitioned together. A large family
+	// hands each run to a subtask, so other workers share the family, and
+	// closes a run once it holds SPLIT_FAMILY_GENES genes, so big components
+	// still spread. Shared components stay on this thread: subtasks never
+	// wait on another family's labeling.
+	bool split = pool and starts.size()>1 and reachedGenes>=SPLIT_FAMILY_GENES;
+	vector<size_t> runEnd(starts.size(), 0);
+	for(size_t k=0; k<starts.size(); )
+	{
+		size_t end=k+1, genesInRun=components.componentSize(reached[k]);
+		if(!components.shared(reached[k]))
 		{
-			vector<string> group_local;
-			vector<string> AllTrees_local;
-			vector<vector<string> > AllTreeGeneName_local;
+			while(end<starts.size() and end-k<BATCH_COMPONENTS and !components.shared(reached[end])
+			      and !(split and genesInRun>=SPLIT_FAMILY_GENES))
+				genesInRun+=components.componentSize(reached[end++]);
+		}
+		runEnd[k]=end;
+		k=end;
+	}
 
-			// Perform DFS to find connected components
-			DFS_Local(*j, visited_local, group_local, adjacency);
+	vector<ComponentLabeling> labelings(split ? starts.size() : 0);
+	vector<future<void> > pending(labelings.size());
+	for(size_t k=0; k<labelings.size(); k=runEnd[k])
+	{
+		if(components.shared(reached[k])) continue;
+		const GeneId* first=&starts[k];
+		size_t count=runEnd[k]-k;
+		ComponentLabeling* labeling=&labelings[k];
+		pending[k]=pool->enqueueSubtask([first, count, labeling, &genes, &graph, &speciesTree, S, pool]() {
+			vector<vector<string> > AllTrees_run;
+			vector<vector<vector<GeneId> > > AllTreeGeneName_run;
+			if(count>1)
+				PartitionComponents_Local(first, count, genes, graph, speciesTree, S, pool,
+				                          AllTrees_run, AllTreeGeneName_run);
+			for(size_t c=0; c<count; c++)
+			{
+				stringstream buffer;
+				if(count>1)
+					TreeLabeling_Local(AllTrees_run[c], AllTreeGeneName_run[c], labeling[c].births,
+					                   labeling[c].duplications, labeling[c].losses, buffer, genes, speciesTree);
+				else
+					ProcessComponent_Local(first[c], genes, graph, speciesTree, S, pool, labeling[c].births,
+					                       labeling[c].duplications, labeling[c].losses, buffer);
+				labeling[c].orthoGroups=buffer.str();
+			}
+		});
+	}
 
-			// Partition the group into layers
-			Partition_Local(group_local, AllTrees_local, AllTreeGeneName_local,
-			               species, edges, speciesTree, S);
+	// Results are added in component order whoever computed them
+	// (subtasks still write into labelings, so they are joined before
+	// an error leaves this frame)
+	try
+	{
+		for(size_t k=0; k<starts.size(); k=runEnd[k])
+		{
+			ComponentResult* shared = components.shared(reached[k]);
+			if(!shared)
+			{
+				size_t count=runEnd[k]-k;
+				if(split)
+				{
+					pool->helpUntilReady(pending[k]);
+					pending[k].get();
+					for(size_t c=k; c<runEnd[k]; c++)
+					{
+						labelings[c].replayInto(GeneBirth_local, GeneDuplication_local, GeneLoss_local,
+						                        orthoGroupBuffer);
+						labelings[c].clear();
+					}
+				}
+				else if(count>1)
+				{
+					vector<vector<string> > AllTrees_run;
+					vector<vector<vector<GeneId> > > AllTreeGeneName_run;
+					PartitionComponents_Local(&starts[k], count, genes, graph, speciesTree, S, pool,
+					                          AllTrees_run, AllTreeGeneName_run);
+					for(size_t c=0; c<count; c++)
+						TreeLabeling_Local(AllTrees_run[c], AllTreeGeneName_run[c],
+						                   GeneBirth_local, GeneDuplication_local, GeneLoss_local,
+						                   orthoGroupBuffer, genes, speciesTree);
+				}
+				else
+					ProcessComponent_Local(starts[k], genes, graph, speciesTree, S, pool,
+					                       GeneBirth_local, GeneDuplication_local, GeneLoss_local,
+					                       orthoGroupBuffer);
+				continue;
+			}
 
-			// Perform tree labeling and analysis
-			TreeLabeling_Local(AllTrees_local, AllTreeGeneName_local,
-			                  GeneBirth_local, GeneDuplication_local, GeneLoss_local,
-			                  orthoGroupBuffer, speciesTree);
+			// A component of several families is labeled once, by whichever
+			// family gets there first, and replayed into each of them
+			call_once(shared->done, [&]() {
+				stringstream buffer;
+				ComponentLabeling& labeling = shared->labeling;
+				ProcessComponent_Local(starts[k], genes, graph, speciesTree, S, pool,
+				                       labeling.births, labeling.duplications, labeling.losses, buffer);
+				labeling.orthoGroups = buffer.str();
+			});
+			shared->labeling.replayInto(GeneBirth_local, GeneDuplication_local, GeneLoss_local,
+			                            orthoGroupBuffer);
+			if(--shared->pending==0) shared->labeling.clear();
 		}
 	}
+	catch(...)
+	{
+		for(size_t k=0; k<pending.size(); k++)
+			if(pending[k].valid()) pool->helpUntilReady(pending[k]);
+		throw;
+	}
 
 	// Aggregate results (thread-safe)
 	aggregator.aggregate(GeneBirth_local, GeneDuplication_local, GeneLoss_local);
@@ -295,13 +936,13 @@ void printGeneInfo(char* filename)
 {
 	ofstream outfile(filename);
 	outfile<<"Gene birth: ";
-	for(set<string>::iterator it=AllGeneBirth.begin(); it!=AllGeneBirth.end(); it++)
-		outfile<<*it<<"\t";
+	for(set<GeneId>::iterator it=AllGeneBirth.begin(); it!=AllGeneBirth.end(); it++)
+		outfile<<genes.name(*it)<<"\t";
 	outfile<<endl;
 
 	outfile<<"Gene duplication: ";
-	for(set<string>::iterator it=AllGeneDuplication.begin(); it!=AllGeneDuplication.end(); it++)
-		outfile<<*it<<"\t";
+	for(set<GeneId>::iterator it=AllGeneDuplication.begin(); it!=AllGeneDuplication.end(); it++)
+		outfile<<genes.name(*it)<<"\t";
 	outfile<<endl;
 
 	outfile<<"Gene loss: ";
@@ -311,15 +952,199 @@ void printGeneInfo(char* filename)
 	outfile.close();
 }
 
-int main(int argc, char** argv)
+// Lines to read from each pair file in an indexed run (--index), ready
+// once node `ready` has finished
+struct PairLineSelection {
+	vector<vector<uint64_t> > lines;
+	size_t ready;
+};
+
+// Selected lines are parsed in groups of this many per task
+const size_t SELECTED_LINES_PER_CHUNK = 1 << 16;
+
+// Add the loading of all Si_Sj pair files to the startup graph. Every
+// file is inflated (if block-compressed), split and parsed on its own, and
+// each chunk is routed into the graph build as soon as it is parsed; the
+// rest of the build starts once every chunk is in. With a selection, only
+// the selected lines of each file are parsed.
+// Returns the node after which genes and graph are filled in.
+size_t LoadOrthologPairs(TaskGraph& startup, vector<IOTask>& pairFiles, GraphBuilder& builder,
+                         const PairLineSelection* selection = nullptr)
 {
-	if(argc!=6)
-	{
-		cout<<"Usage: MultiMSOAR2.0 <#species> <speciesTree> <GeneFamily> <-o GeneInfo> <-o OrthoGroups>"<<endl;
-		exit(1);
+	cout << "Loading ortholog pair files in parallel..." << endl;
+	auto io_start = chrono::high_resolution_clock::now();
+	auto build_start = make_shared<chrono::high_resolution_clock::time_point>();
+
+	// Map every pair file up front; the stages only read the mappings.
+	// Si_Sj.gz is used when the plain Si_Sj is absent.
+	for(int i=0; i<S; i++) {
+		for(int j=i+1; j<S; j++) {
+			pairFiles.push_back(IOTask(i, j, resolvePairFile(i, j)));
+			IOTask& task = pairFiles.back();
+			task.file = MappedFile(task.filename);
+			if(!task.file.is_open())
+				cerr<<"Cannot open file "<<task.filename<<endl;
+		}
 	}
 
-	ifstream infile(argv[2]);
+	// Joins the parsing of every chunk of every file
+	size_t parsed = startup.add([&pairFiles, selection, io_start, build_start]() {
+		size_t io_bytes = 0;
+		for(const auto& task : pairFiles) io_bytes += task.textSize();
+
+		*build_start = chrono::high_resolution_clock::now();
+		double parse_seconds = chrono::duration<double>(*build_start - io_start).count();
+		stringstream throughput;
+		throughput << fixed << setprecision(1) << io_bytes / 1048576.0 << " MB) at "
+		           << (parse_seconds > 0 ? io_bytes / 1048576.0 / parse_seconds : 0.0) << " MB/s";
+		cout << "Parsed " << pruneStats.parsed << " ortholog pairs (" << throughput.str() << endl;
+		if(pruning.any())
+			cout << "Pruned " << pruneStats.dropped() << " of " << pruneStats.parsed << " ortholog pairs ("
+			     << pruneStats.belowMinScore << " below min score, "
+			     << pruneStats.outsideTopK << " outside top-k, "
+			     << pruneStats.notReciprocal << " not reciprocal best)" << endl;
+
+		for(const auto& task : pairFiles)
+			if(task.pairCount()==0 and !selection)
+				cout<<"Warning: No data loaded from file "<<task.filename<<endl;
+	});
+
+	for(size_t t=0; t<pairFiles.size(); t++) {
+		IOTask* task = &pairFiles[t];
+
+		// Block-compressed inputs: index the blocks, then inflate runs of
+		// blocks in parallel straight into the file's text buffer
+		vector<size_t> inflated;
+		auto inflate_ok = make_shared<vector<char> >();
+		if(isBgzf(task->file.data(), task->file.size())) {
+			auto blocks = make_shared<vector<BgzfBlock> >();
+			uint64_t total = 0;
+			string error;
+			if(!indexBgzfBlocks(task->file.data(), task->file.size(), *blocks, total, error)) {
+				cerr<<"Cannot read "<<task->filename<<": "<<error<<endl;
+				task->file = MappedFile();
+				continue;
+			}
+			task->inflated.reset(new char[total > 0 ? total : 1]);
+			task->inflatedSize = total;
+
+			size_t first = 0;
+			while(first < blocks->size()) {
+				size_t last = first;
+				uint64_t run = 0;
+				while(last < blocks->size() and run < PAIR_CHUNK_BYTES) run += (*blocks)[last++].inflatedSize;
+
+				size_t slot = inflate_ok->size();
+				inflate_ok->push_back(1);
+				inflated.push_back(startup.add([task, blocks, first, last, inflate_ok, slot]() {
+					string error;
+					if(inflateBgzfBlocks(task->file.data(), &(*blocks)[first], last - first,
+					                     task->inflated.get(), error)) return;
+					cerr<<"Cannot read "<<task->filename<<": "<<error<<endl;
+					(*inflate_ok)[slot] = 0;
+				}));
+				first = last;
+			}
+		}
+		// A plain gzip input has no block index: inflate it whole on one
+		// worker rather than parse the compressed bytes as text
+		else if(isGzip(task->file.data(), task->file.size()) or
+		        (task->filename.size() > 3 and task->filename.compare(task->filename.size() - 3, 3, ".gz") == 0)) {
+			if(task->file.is_open()) {
+				inflate_ok->push_back(1);
+				inflated.push_back(startup.add([task, inflate_ok]() {
+					string error;
+					if(inflateGzip(task->file.data(), task->file.size(), task->inflated, task->inflatedSize, error)) return;
+					cerr<<"Cannot read "<<task->filename<<": "<<error<<endl;
+					(*inflate_ok)[0] = 0;
+				}));
+			}
+		}
+
+		// Split the text into newline-aligned chunks, so a single huge file
+		// is spread over all workers, and parse, prune and route each chunk.
+		// Rank-based pruning needs the whole file, so routing then waits
+		// for a per-file pruning stage.
+		if(selection) inflated.push_back(selection->ready);
+		size_t split = startup.add([&startup, task, t, selection, inflate_ok, parsed]() {
+			if(find(inflate_ok->begin(), inflate_ok->end(), 0) != inflate_ok->end()) {
+				task->inflated.reset();
+				task->inflatedSize = 0;
+				task->file = MappedFile();
+				return;
+			}
+
+			// Byte ranges of the text, or ranges of the selected line list
+			const char* text = task->text();
+			const char* text_end = text + task->textSize();
+			const uint64_t* lines = selection ? selection->lines[t].data() : nullptr;
+			vector<pair<size_t,size_t> > ranges;
+			if(selection) {
+				for(size_t first=0; first<selection->lines[t].size(); first+=SELECTED_LINES_PER_CHUNK)
+					ranges.push_back(make_pair(first, min(first + SELECTED_LINES_PER_CHUNK,
+					                                      selection->lines[t].size())));
+			}
+			else
+				ranges = pairparser::splitAtLines(text, task->textSize(), PAIR_CHUNK_BYTES);
+
+			task->chunks.resize(ranges.size());
+			vector<size_t> chunk_nodes;
+			for(size_t c=0; c<ranges.size(); c++) {
+				size_t first = ranges[c].first, last = ranges[c].second;
+				PairChunk* chunk = &task->chunks[c];
+				chunk_nodes.push_back(startup.add([text, text_end, lines, first, last, chunk]() {
+					if(lines) {
+						for(size_t k=first; k<last; k++) {
+							const char* begin = text + lines[k];
+							const char* eol = static_cast<const char*>(memchr(begin, '\n', text_end - begin));
+							pairparser::parseOrthologPairs(begin, eol ? eol : text_end, chunk->pairs);
+						}
+					}
+					else
+						pairparser::parseOrthologPairs(text + first, text + last, chunk->pairs);
+					pruneStats.parsed += chunk->pairs.size();
+					pruneByScore(chunk->pairs, pruning, pruneStats);
+					if(!pruning.ranked()) GraphBuilder::route(*chunk);
+				}));
+				startup.depend(parsed, chunk_nodes.back());
+			}
+			if(!pruning.ranked()) return;
+
+			startup.depend(parsed, startup.add([&startup, task, parsed]() {
+				pruneByRank(task->chunks, pruning, pruneStats);
+				for(size_t c=0; c<task->chunks.size(); c++) {
+					PairChunk* chunk = &task->chunks[c];
+					startup.depend(parsed, startup.add([chunk]() { GraphBuilder::route(*chunk); }));
+				}
+			}, chunk_nodes));
+		}, inflated);
+		startup.depend(parsed, split);
+	}
+
+	size_t built = builder.schedule(startup, pairFiles, parsed);
+
+	// The parsed pairs are not needed once the graph is built
+	return startup.add([&pairFiles, build_start]() {
+		auto build_end = chrono::high_resolution_clock::now();
+		cout << "Built graph of " << genes.size() << " genes in "
+		     << chrono::duration_cast<chrono::milliseconds>(build_end - *build_start).count() << " ms" << endl;
+		vector<IOTask>().swap(pairFiles);
+	}, vector<size_t>(1, built));
+}
+
+// Use a compiled .mmsg snapshot as the global graph; the CSR arrays are
+// read straight from the mapping, which must stay open
+void LoadGraphCache(const GraphCache& cache)
+{
+	genes.assignSorted(cache.names(), cache.nameOffsets(), cache.geneSpecies(), cache.geneCount());
+	graph.borrow(cache.adjacencyOffsets(), cache.edgeOffsets(), cache.neighbors(), cache.weights(),
+	             cache.geneCount());
+}
+
+// Parse the Newick species tree into its postfix form ('1' leaf, 'N' node)
+void LoadSpeciesTree(const char* filename)
+{
+	ifstream infile(filename);
 	string tmpSpeciesTree;
 	getline(infile, tmpSpeciesTree);
 	infile.close();
@@ -348,104 +1173,227 @@ int main(int argc, char** argv)
 		else
 			tmpL+=tmpSpeciesTree[i];
 	}
-	
-
-	S=atoi(argv[1]);
-	//S=(speciesTree.size()+1)/2;
-
-	cout << "MultiMSOAR 2.0 - Multi-threaded Edition" << endl;
-	cout << "Hardware threads available: " << thread::hardware_concurrency() << endl;
+}
 
-	// ===========================================
-	// TIER 2: PARALLEL FILE I/O
-	// ===========================================
-	cout << "Loading ortholog pair files in parallel..." << endl;
-	auto io_start = chrono::high_resolution_clock::now();
+void printUsage()
+{
+	cout<<"Usage: MultiMSOAR2.0 <#species> <speciesTree> <GeneFamily> <-o GeneInfo> <-o OrthoGroups> [-g graph.mmsg] [pruning]"<<endl;
+	cout<<"       MultiMSOAR2.0 <#species> <speciesTree> <GeneFamily> <-o GeneInfo> <-o OrthoGroups> --index genes.mmsi [pruning]"<<endl;
+	cout<<"       MultiMSOAR2.0 compile <#species> <graph.mmsg> [pruning]"<<endl;
+	cout<<"       MultiMSOAR2.0 index <#species> <genes.mmsi>"<<endl;
+	cout<<"Pruning: --min-score <score> --top-k <k> --reciprocal-best"<<endl;
+}
 
-	// Create thread pool for file I/O
-	ThreadPool io_pool(min(8, (int)thread::hardware_concurrency()));
+// Consume a pruning option at argv[k]; false if argv[k] is not one
+bool ParsePruneOption(int argc, char** argv, int& k)
+{
+	string option=argv[k];
+	if(option=="--min-score" and k+1<argc)
+	{
+		pruning.minScoreSet=true;
+		pruning.minScore=atof(argv[++k]);
+	}
+	else if(option=="--top-k" and k+1<argc and atoi(argv[k+1])>0)
+		pruning.topK=atoi(argv[++k]);
+	else if(option=="--reciprocal-best")
+		pruning.reciprocalBest=true;
+	else
+		return false;
+	return true;
+}
 
-	// Vector to store file I/O tasks
-	vector<future<IOTask>> io_futures;
+int main(int argc, char** argv)
+{
+	// Compile mode: snapshot the pair files into a binary graph cache
+	if(argc>=2 and string(argv[1])=="compile")
+	{
+		if(argc<4)
+		{
+			printUsage();
+			exit(1);
+		}
+		for(int k=4; k<argc; k++)
+		{
+			if(!ParsePruneOption(argc, argv, k))
+			{
+				printUsage();
+				exit(1);
+			}
+		}
+		S=atoi(argv[2]);
+		cout << "MultiMSOAR 2.0 - compiling graph cache for " << S << " species" << endl;
+		ThreadPool io_pool(thread::hardware_concurrency());
+		TaskGraph stages(io_pool);
+		vector<IOTask> pairFiles;
+		GraphBuilder builder(genes, graph);
+		LoadOrthologPairs(stages, pairFiles, builder);
+		stages.start();
+		stages.wait();
+		if(!writeGraphCache(argv[3], S, pruning, genes, graph))
+		{
+			cerr<<"Cannot write graph cache "<<argv[3]<<endl;
+			exit(1);
+		}
+		cout << "Wrote " << genes.size() << " genes to " << argv[3] << endl;
+		return 0;
+	}
 
-	// Launch parallel file reads
-	for(int i=0; i<S; i++) {
-		for(int j=i+1; j<S; j++) {
-			io_futures.push_back(io_pool.enqueue([i, j]() -> IOTask {
-				IOTask task(i, j, "");
-				stringstream ss;
-				ss<<"S"<<i<<"_S"<<j;
-				task.filename = ss.str();
-
-				ifstream file(task.filename.c_str());
-				if(file.fail()) {
-					cerr<<"Cannot open file "<<task.filename<<endl;
-					return task;
-				}
+	// Index mode: record where every gene's lines are in the pair files
+	if(argc>=2 and string(argv[1])=="index")
+	{
+		if(argc!=4)
+		{
+			printUsage();
+			exit(1);
+		}
+		S=atoi(argv[2]);
+		cout << "MultiMSOAR 2.0 - building gene index for " << S << " species" << endl;
+		ThreadPool io_pool(thread::hardware_concurrency());
+		TaskGraph stages(io_pool);
+		vector<IOTask> pairFiles;
+		GraphBuilder builder(genes, graph);
+		builder.recordLines();
+		LoadOrthologPairs(stages, pairFiles, builder);
+		stages.start();
+		stages.wait();
+		if(!writeGeneIndex(argv[3], S, genes, builder.postingOffsets(), builder.postingNeighbors(),
+		                   builder.linePositions()))
+		{
+			cerr<<"Cannot write gene index "<<argv[3]<<endl;
+			exit(1);
+		}
+		cout << "Wrote " << genes.size() << " genes to " << argv[3] << endl;
+		return 0;
+	}
 
-				string line;
-				while(getline(file, line)) {
-					stringstream line_ss;
-					line_ss<<line;
-					string gene1, gene2;
-					double score;
-					line_ss>>gene1>>gene2>>score;
+	if(argc<6)
+	{
+		printUsage();
+		exit(1);
+	}
 
-					task.ortholog_pairs.push_back(make_tuple(gene1, gene2, score));
-				}
-				return task;
-			}));
+	string graphCachePath="";
+	string geneIndexPath="";
+	for(int k=6; k<argc; k++)
+	{
+		if(string(argv[k])=="-g" and k+1<argc) graphCachePath=argv[++k];
+		else if(string(argv[k])=="--index" and k+1<argc) geneIndexPath=argv[++k];
+		else if(ParsePruneOption(argc, argv, k)) continue;
+		else
+		{
+			printUsage();
+			exit(1);
 		}
 	}
 
-	// Wait for all I/O tasks to complete and aggregate results
-	for(auto& fut : io_futures) {
-		IOTask task = fut.get();
-		if(task.ortholog_pairs.empty()) {
-			cout<<"Warning: No data loaded from file "<<task.filename<<endl;
-			continue;
-		}
+	if(graphCachePath!="" and geneIndexPath!="")
+	{
+		cerr<<"Use either -g or --index, not both"<<endl;
+		exit(1);
+	}
 
-		// Merge into global data structures
-		for(const auto& pair : task.ortholog_pairs) {
-			string gene1 = get<0>(pair);
-			string gene2 = get<1>(pair);
-			double score = get<2>(pair);
+	S=atoi(argv[1]);
+	//S=(speciesTree.size()+1)/2;
 
-			species[gene1] = task.i;
-			species[gene2] = task.j;
+	cout << "MultiMSOAR 2.0 - Multi-threaded Edition" << endl;
+	cout << "Hardware threads available: " << thread::hardware_concurrency() << endl;
 
-			adjacency[gene1].push_back(gene2);
-			adjacency[gene2].push_back(gene1);
+	// ===========================================
+	// TIER 2: PIPELINED STARTUP
+	// ===========================================
+	// The species tree, the family file and the pair files load as
+	// independent stages; families are resolved once the graph is built,
+	// and are processed on the same pool as soon as the components are
+	// labeled
+	auto io_start = chrono::high_resolution_clock::now();
 
-			edges[make_pair(gene1,gene2)] = score;
-			edges[make_pair(gene2,gene1)] = score;
-		}
+	ThreadPool pool(thread::hardware_concurrency());
+	TaskGraph startup(pool);
+	vector<IOTask> pairFiles;
+	GraphBuilder builder(genes, graph);
+
+	size_t species_tree = startup.add([&argv]() { LoadSpeciesTree(argv[2]); });
+
+	FamilyIndex families;
+	size_t family_file = startup.add([&argv, &families]() {
+		if(!families.open(argv[3]))
+			cerr<<"Cannot open file "<<argv[3]<<endl;
+		families.prepare();
+	});
+
+	size_t loaded;
+	GraphCache cache;
+	GeneIndex geneIndex;
+	PairLineSelection selection;
+	if(graphCachePath!="" and cache.open(graphCachePath, S, pruning))
+	{
+		loaded = startup.add([&cache, &graphCachePath]() {
+			LoadGraphCache(cache);
+			cout << "Loaded " << cache.geneCount() << " genes from graph cache " << graphCachePath << endl;
+		});
 	}
-
-	auto io_end = chrono::high_resolution_clock::now();
-	auto io_duration = chrono::duration_cast<chrono::milliseconds>(io_end - io_start);
-	cout << "File I/O completed in " << io_duration.count() << " ms" << endl;
-	
-	map<int, set<string> > RealFamily;
-	ifstream infile2(argv[3]);
-	string oneFamily;
-	int indexFamily=0;
-	while(getline(infile2, oneFamily))
+	else if(geneIndexPath!="" and geneIndex.open(geneIndexPath, S))
+	{
+		// Only the lines of the families' connected components are read
+		selection.ready = startup.add([&geneIndex, &geneIndexPath, &families, &selection]() {
+			size_t reached = geneIndex.collectComponents(families.geneNames(), selection.lines);
+			size_t selected = 0;
+			for(size_t t=0; t<selection.lines.size(); t++) selected += selection.lines[t].size();
+			cout << "Selected " << selected << " pair lines of " << reached << " genes from gene index "
+			     << geneIndexPath << endl;
+		}, vector<size_t>(1, family_file));
+		loaded = LoadOrthologPairs(startup, pairFiles, builder, &selection);
+	}
+	else
 	{
-		stringstream ss(oneFamily);
-		string name;
-		while(ss>>name) RealFamily[indexFamily].insert(name);
-		indexFamily++;
+		if(graphCachePath!="")
+			cout << "Warning: ignoring graph cache: " << cache.reason() << endl;
+		if(geneIndexPath!="")
+			cout << "Warning: ignoring gene index: " << geneIndex.reason() << endl;
+		loaded = LoadOrthologPairs(startup, pairFiles, builder);
 	}
-	infile2.close();
+
+	startup.add([io_start]() {
+		auto io_end = chrono::high_resolution_clock::now();
+		auto io_duration = chrono::duration_cast<chrono::milliseconds>(io_end - io_start);
+		cout << "File I/O completed in " << io_duration.count() << " ms" << endl;
+	}, vector<size_t>(1, loaded));
+
+	// Genes absent from every pair file have no edges and cannot form a
+	// group, so only known genes are kept
+	vector<size_t> family_deps;
+	family_deps.push_back(loaded);
+	family_deps.push_back(family_file);
+	size_t resolved = startup.addRange(FAMILY_RESOLVE_PARTS, [&families](size_t part) {
+		families.resolve(genes, families.size() * part / FAMILY_RESOLVE_PARTS,
+		                 families.size() * (part + 1) / FAMILY_RESOLVE_PARTS);
+	}, family_deps);
+	size_t compacted = startup.add([&families]() { families.compact(); }, vector<size_t>(1, resolved));
+
+	// Label the connected components once for all families, then find the
+	// components that several families share
+	ComponentIndex components;
+	vector<size_t> sharing_deps;
+	sharing_deps.push_back(components.schedule(startup, graph, loaded));
+	sharing_deps.push_back(compacted);
+	size_t sharing = startup.add([&components]() { components.prepareSharing(); }, sharing_deps);
+	size_t counted = startup.addRange(FAMILY_RESOLVE_PARTS, [&families, &components](size_t part) {
+		components.countFamilies(families, families.size() * part / FAMILY_RESOLVE_PARTS,
+		                         families.size() * (part + 1) / FAMILY_RESOLVE_PARTS);
+	}, vector<size_t>(1, sharing));
+	size_t shared = startup.add([&components]() {
+		components.assignShared();
+		cout << "Found " << components.size() << " connected components, "
+		     << components.sharedSize() << " shared by several families" << endl;
+	}, vector<size_t>(1, counted));
 
 
 	// ===========================================
 	// TIER 1: PARALLEL FAMILY PROCESSING
 	// ===========================================
-	cout << "Processing " << RealFamily.size() << " gene families in parallel..." << endl;
-	auto family_start = chrono::high_resolution_clock::now();
+	// Families join the startup graph once the components are labeled and
+	// their shared slots assigned; the pool runs them while the remaining
+	// startup nodes drain
 
 	// Create result aggregator
 	ResultAggregator aggregator(AllGeneBirth, AllGeneDuplication, AllGeneLoss);
@@ -453,44 +1401,54 @@ int main(int argc, char** argv)
 	// Open output file
 	ofstream orthoGroupOut(argv[5]);
 
-	// Create thread pool for family processing
-	ThreadPool family_pool(thread::hardware_concurrency());
-
-	// Launch parallel family processing
-	vector<future<void>> family_futures;
-
 	// Create local references to avoid lambda capture warnings
-	const map<string,int>& species_ref = species;
-	const map<string, vector<string>>& adjacency_ref = adjacency;
-	const map<pair<string,string>, double>& edges_ref = edges;
+	const GeneDictionary& genes_ref = genes;
+	const OrthologGraph& graph_ref = graph;
 	const string& speciesTree_ref = speciesTree;
 	const int S_val = S;
 
-	for(map<int,set<string> >::iterator it=RealFamily.begin(); it!=RealFamily.end(); it++)
-	{
-		int family_id = it->first;
-		set<string> family_genes = it->second;
+	// Time from the start of loading until the first family is picked up
+	once_flag first_family;
+	chrono::high_resolution_clock::time_point first_family_time;
+	chrono::high_resolution_clock::time_point family_start;
 
-		// Enqueue family processing task
-		family_futures.push_back(family_pool.enqueue([family_id, family_genes,
-		                                              &species_ref, &adjacency_ref,
-		                                              &edges_ref, &speciesTree_ref,
-		                                              S_val, &aggregator, &orthoGroupOut]() {
-			processFamilyTask(family_id, family_genes, species_ref, adjacency_ref, edges_ref,
-			                 speciesTree_ref, S_val, aggregator, orthoGroupOut);
-		}));
-	}
+	const FamilyIndex& families_ref = families;
 
-	// Wait for all families to complete
-	for(auto& fut : family_futures) {
-		fut.get();
-	}
+	vector<size_t> processing_deps;
+	processing_deps.push_back(shared);
+	processing_deps.push_back(species_tree);
+	startup.add([&]() {
+		cout << "Processing " << families.size() << " gene families in parallel..." << endl;
+		family_start = chrono::high_resolution_clock::now();
+
+		// One node per family; it only needs the family's index
+		for(size_t family_id=0; family_id<families.size(); family_id++)
+		{
+			startup.add([family_id, &families_ref, &components, &pool,
+			             &genes_ref, &graph_ref, &speciesTree_ref,
+			             S_val, &aggregator, &orthoGroupOut,
+			             &first_family, &first_family_time]() {
+				call_once(first_family, [&first_family_time]() {
+					first_family_time = chrono::high_resolution_clock::now();
+				});
+				processFamilyTask(families_ref, family_id, components, genes_ref, graph_ref,
+				                 speciesTree_ref, S_val, &pool, aggregator, orthoGroupOut);
+			});
+		}
+	}, processing_deps);
+
+	// Wait for startup and all families to complete
+	startup.start();
+	startup.wait();
 
 	orthoGroupOut.close();
 
 	auto family_end = chrono::high_resolution_clock::now();
 	auto family_duration = chrono::duration_cast<chrono::milliseconds>(family_end - family_start);
 	cout << "Family processing completed in " << family_duration.count() << " ms" << endl;
+	if(families.size()>0)
+		cout << "Time to first family: "
+		     << chrono::duration_cast<chrono::milliseconds>(first_family_time - io_start).count() << " ms" << endl;
 
 	// Print summary statistics
 	auto total_duration = chrono::duration_cast<chrono::milliseconds>(family_end - io_start);
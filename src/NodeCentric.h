@@ -5,20 +5,67 @@
 #include <vector>
 #include <iomanip>
 #include <set>
+#include <algorithm>
 
 #define MAXINT (1<<30)
 
 using namespace std;
 
+//Fewest substitutions below a node for one value, and the children's values
+struct NodeLabel
+{
+	long long value;
+	int changes;
+	long long leftV, rightV;
+};
+
 class Node
 {
 	public:
-		map<long long,int> changes;
-		map<long long,long long> leftV, rightV;
+		//Labels sorted by value
+		vector<NodeLabel> labels;
 		Node* left;
 		Node* right;
 		Node(){left=NULL; right=NULL;}
-		Node(long long v) { changes[v]=0; left=right=NULL; }
+		Node(long long v) { NodeLabel l={v, 0, 0LL, 0LL}; labels.push_back(l); left=right=NULL; }
+
+		//Label of a value the node has
+		const NodeLabel& find(long long v) const
+		{
+			size_t lo=0, hi=labels.size()-1;
+			while(lo<hi)
+			{
+				size_t mid=(lo+hi)/2;
+				if(labels[mid].value<v) lo=mid+1; else hi=mid;
+			}
+			return labels[lo];
+		}
+};
+
+//Best labelings of one child under each value of its parent, indexed by
+//the parent's value; MAXINT marks a value that has none
+struct ChildTables
+{
+	//best: parents with a non-zero species; zero and nonZeroMin: all-zero
+	//parents over an all-zero child and over the best other child
+	vector<int> best, zero, nonZeroMin;
+	vector<long long> bestNode, nonZeroNode;
+	//Values set in best, zero and nonZeroMin
+	vector<long long> bestKeys, zeroKeys, nonZeroKeys;
+
+	void resize(size_t n)
+	{
+		best.assign(n, MAXINT); zero.assign(n, MAXINT); nonZeroMin.assign(n, MAXINT);
+		bestNode.resize(n); nonZeroNode.resize(n);
+	}
+
+	void clear()
+	{
+		for(size_t i=0; i<bestKeys.size(); i++) best[bestKeys[i]]=MAXINT;
+		for(size_t i=0; i<zeroKeys.size(); i++) zero[zeroKeys[i]]=MAXINT;
+		for(size_t i=0; i<nonZeroKeys.size(); i++) nonZeroMin[nonZeroKeys[i]]=MAXINT;
+		bestKeys.clear(); zeroKeys.clear(); nonZeroKeys.clear();
+	}
 };
 
 
@@ -41,9 +88,18 @@ vector<string> trees;
 //Labeling Results
 vector<long long> results;
 
-map<long long, int> leftMap, rightMap;
-map<long long, long long> leftMapNode, rightMapNode;
-//map<long long, int> leftZero, rightZero;
+//Tables of the children of the node being labeled. All tables have one
+//entry per value of 2N bits, at most 4^N; NodeCentric only labels
+//fewer than 5 trees, so they stay small and need no hashing
+ChildTables leftTables, rightTables;
+
+//Substitutions of the child being combined, by value (MAXINT: none)
+vector<int> childChanges;
+
+//Labels of the node being labeled, by value (MAXINT: none)
+vector<int> changes;
+vector<long long> leftV, rightV;
+vector<long long> changedKeys;
 
 
 vector<pair<int,int> > vp[50];
@@ -78,8 +134,9 @@ void PostOrderTraversal(Node* cur, long long value)
 	//if(cur->left==NULL or cur->right==NULL) return;
 	
 	if(cur==NULL) return;
-	PostOrderTraversal(cur->left, (cur->leftV)[value]);
-	PostOrderTraversal(cur->right,(cur->rightV)[value]);
+	const NodeLabel& label=cur->find(value);
+	PostOrderTraversal(cur->left, label.leftV);
+	PostOrderTraversal(cur->right, label.rightV);
 
 	results.push_back(value);
 }
@@ -92,9 +149,9 @@ int getBit(long long p, int i)
 
 void go(Node* left, Node* right, Node* child)
 {
-	long long lv=((left->changes).begin())->first;
-	long long rv=((right->changes).begin())->first;
-	long long cv=((child->changes).begin())->first;
+	long long lv=(left->labels).front().value;
+	long long rv=(right->labels).front().value;
+	long long cv=(child->labels).front().value;
 
 	for(int i=0; i<N; i++)
 	{
@@ -125,43 +182,38 @@ void go(Node* left, Node* right, Node* child)
 	}
 }
 
-map<long long, int> leftZero, rightZero;
-map<long long, int> leftNonZeroMin, rightNonZeroMin;
-map<long long, long long> leftNonZeroNode, rightNonZeroNode;
-
+//Keep the smaller of table[value] and sub, listing value the first time
+//it is set
+bool lower(vector<int>& table, vector<long long>& keys, long long value, int sub)
+{
+	int& cur=table[value];
+	if(cur<=sub) return false;
+	if(cur==MAXINT) keys.push_back(value);
+	cur=sub;
+	return true;
+}
 
-void allCombination(int pos, long long parentV, long long childV, int sub, Node* child)
+void allCombination(int pos, long long parentV, long long childV, int sub, ChildTables& t)
 {
 	if(pos==N)
 	{
-		if((child->changes).count(childV))
-		{
-			if((parentV & checkZero)==0)
-			{
-				if(childV==0) 
-					leftZero[parentV]=sub+(child->changes)[childV];
-				else 
-				{
-					if(leftNonZeroMin.count(parentV)==0 or leftNonZeroMin[parentV] > sub+(child->changes)[childV])
-					{
-						leftNonZeroMin[parentV]=sub+(child->changes)[childV];
-						leftNonZeroNode[parentV]=childV;
-					}
-				}
-			}
-			else
-			{
-				if( (childV & checkZero)==0 and childV!=0 ) return;
+		int c=childChanges[childV];
+		if(c==MAXINT) return;
 
-				if(leftMap.count(parentV)==0 or leftMap[parentV]>sub+(child->changes)[childV])
-				{
-					leftMap[parentV]=sub+(child->changes)[childV];
-					leftMapNode[parentV]=childV;
-				}
-			}
+		if((parentV & checkZero)==0)
+		{
+			if(childV==0)
+				lower(t.zero, t.zeroKeys, parentV, sub+c);
+			else if(lower(t.nonZeroMin, t.nonZeroKeys, parentV, sub+c))
+				t.nonZeroNode[parentV]=childV;
 		}
 		else
-			return;
+		{
+			if( (childV & checkZero)==0 and childV!=0 ) return;
+
+			if(lower(t.best, t.bestKeys, parentV, sub+c))
+				t.bestNode[parentV]=childV;
+		}
 	}
 	else
 	{
@@ -170,54 +222,26 @@ void allCombination(int pos, long long parentV, long long childV, int sub, Node*
 			long long p=vp[pos][i].first;
 			long long q=vp[pos][i].second;
 
-			allCombination(pos+1, parentV|(p<<(2*pos)), childV|(q<<(2*pos)), sub+((p&1)^(q&1)), child);
+			allCombination(pos+1, parentV|(p<<(2*pos)), childV|(q<<(2*pos)), sub+((p&1)^(q&1)), t);
 		}
 	}
 }
 
-void allCombination2(int pos, long long parentV, long long childV, int sub, Node* child)
+//Fill t with the best labelings of child under each value of its parent
+void combineChild(Node* left, Node* right, Node* child, ChildTables& t)
 {
-	if(pos==N)
-	{
-		if((child->changes).count(childV))
-		{
-			if((parentV & checkZero)==0)
-			{
-				if(childV==0)
-					rightZero[parentV]=sub+(child->changes)[childV];
-				else
-				{
-					if(rightNonZeroMin.count(parentV)==0 or rightNonZeroMin[parentV] > sub+(child->changes)[childV])
-					{
-						rightNonZeroMin[parentV] = sub+(child->changes)[childV];
-						rightNonZeroNode[parentV] = childV;
-					}
-				}
-			}
-			else
-			{
-				if( (childV & checkZero)==0 and childV!=0 ) return;
-
-				if(rightMap.count(parentV)==0 or rightMap[parentV]>sub+(child->changes)[childV])
-				{
-					rightMap[parentV]=sub+(child->changes)[childV];
-					rightMapNode[parentV]=childV;
-				}
-			}
-		}
-		else
-			return;
-	}
-	else
-	{
-		for(int i=0; i<vp[pos].size(); i++)
-		{
-			long long p=vp[pos][i].first;
-			long long q=vp[pos][i].second;
+	go(left, right, child);
+	const vector<NodeLabel>& labels=child->labels;
+	for(size_t i=0; i<labels.size(); i++) childChanges[labels[i].value]=labels[i].changes;
+	allCombination(0, 0, 0, 0, t);
+	for(size_t i=0; i<labels.size(); i++) childChanges[labels[i].value]=MAXINT;
+}
 
-			allCombination2(pos+1, parentV|(p<<(2*pos)), childV|(q<<(2*pos)), sub+((p&1)^(q&1)), child);
-		}
-	}
+void relax(long long value, int sub, long long lv, long long rv)
+{
+	if(not lower(changes, changedKeys, value, sub)) return;
+	leftV[value]=lv;
+	rightV[value]=rv;
 }
 
 NodeCentric(vector<string> input)
@@ -229,6 +253,12 @@ NodeCentric(vector<string> input)
 	checkZero=0;
 	for(int i=0; i<N; i++) checkZero=(checkZero<<2)|1LL;
 
+	size_t values=1ULL<<(2*N);
+	leftTables.resize(values); rightTables.resize(values);
+	childChanges.assign(values, MAXINT);
+	changes.assign(values, MAXINT);
+	leftV.resize(values); rightV.resize(values);
+
 	vector<Node*> stack;
 
 	for(int i=0; i<trees[0].size(); i++)
@@ -252,87 +282,62 @@ NodeCentric(vector<string> input)
 			newNode->right=right;
 
 			///////////////////
-			leftMap.clear(); rightMap.clear();
-			leftMapNode.clear(); rightMapNode.clear();
-			leftZero.clear(); rightZero.clear();
-			leftNonZeroMin.clear(); rightNonZeroMin.clear();
-			leftNonZeroNode.clear(); rightNonZeroNode.clear();
+			leftTables.clear(); rightTables.clear();
 			//leftZero=-1; rightZero=-1;
 			//leftNonZeroMin=MAXINT; rightNonZeroMin=MAXINT;
 
 
 			long long start=time(NULL);
 			long long end;
-			go(left, right, left);
-//			cout<<"Go Time: "<<time(NULL)-start<<endl;
-			allCombination(0, 0, 0, 0, left);
+			combineChild(left, right, left, leftTables);
 			end=time(NULL);
 //			cout<<"Combination 1 done: "<<end-start<<endl;
 
 
 			start=time(NULL);
-			go(left, right, right);
-//			cout<<"Go Time: "<<time(NULL)-start<<endl;
-			allCombination2(0, 0, 0, 0, right);
+			combineChild(left, right, right, rightTables);
 			end=time(NULL);
 //			cout<<"Combination 2 done: "<<end-start<<endl;
 
 
-			for(map<long long, int>::iterator it=leftMap.begin(); it!=leftMap.end(); it++)
+			const ChildTables& l=leftTables;
+			const ChildTables& r=rightTables;
+			for(size_t i=0; i<l.bestKeys.size(); i++)
 			{
-				long long value=it->first;
-				if(rightMap.count(value)==0) continue;
-				(newNode->changes)[value]=leftMap[value]+rightMap[value];
-				(newNode->leftV)[value]=leftMapNode[value];
-				(newNode->rightV)[value]=rightMapNode[value];
+				long long value=l.bestKeys[i];
+				if(r.best[value]==MAXINT) continue;
+				relax(value, l.best[value]+r.best[value], l.bestNode[value], r.bestNode[value]);
 			}
 //			cout<<"Non zero done"<<endl;
 
-			for(map<long long, int>::iterator it=leftZero.begin(); it!=leftZero.end(); it++)
+			for(size_t i=0; i<l.zeroKeys.size(); i++)
 			{
-				long long value=it->first;
-				if(rightZero.count(value) > 0)
-				{
-					if( (newNode->changes).count(value)==0 or (newNode->changes)[value]>leftZero[value]+rightZero[value] )
-					{
-						(newNode->changes)[value]=leftZero[value]+rightZero[value];
-						(newNode->leftV)[value]=0LL;
-						(newNode->rightV)[value]=0LL;
-					}
-				}
-				if(rightNonZeroMin.count(value) > 0)
-				{
-					if( (newNode->changes).count(value)==0 or (newNode->changes)[value]>leftZero[value]+rightNonZeroMin[value] )
-					{
-						(newNode->changes)[value]=leftZero[value]+rightNonZeroMin[value];
-						(newNode->leftV)[value]=0LL;
-						(newNode->rightV)[value]=rightNonZeroNode[value];
-					}
-				}
+				long long value=l.zeroKeys[i];
+				if(r.zero[value]!=MAXINT)
+					relax(value, l.zero[value]+r.zero[value], 0LL, 0LL);
+				if(r.nonZeroMin[value]!=MAXINT)
+					relax(value, l.zero[value]+r.nonZeroMin[value], 0LL, r.nonZeroNode[value]);
 			}
 	
-			for(map<long long, int>::iterator it=rightZero.begin(); it!=rightZero.end(); it++)
+			for(size_t i=0; i<r.zeroKeys.size(); i++)
+			{
+				long long value=r.zeroKeys[i];
+				if(l.zero[value]!=MAXINT)
+					relax(value, l.zero[value]+r.zero[value], 0LL, 0LL);
+				if(l.nonZeroMin[value]!=MAXINT)
+					relax(value, l.nonZeroMin[value]+r.zero[value], l.nonZeroNode[value], 0LL);
+			}
+
+			sort(changedKeys.begin(), changedKeys.end());
+			(newNode->labels).reserve(changedKeys.size());
+			for(size_t i=0; i<changedKeys.size(); i++)
 			{
-				long long value=it->first;
-				if(leftZero.count(value) > 0)
-				{
-					if( (newNode->changes).count(value)==0 or (newNode->changes)[value]>leftZero[value]+rightZero[value] )
-					{
-						(newNode->changes)[value]=leftZero[value]+rightZero[value];
-						(newNode->leftV)[value]=0LL;
-						(newNode->rightV)[value]=0LL;
-					}
-				}
-				if(leftNonZeroMin.count(value) > 0)
-				{
-					if( (newNode->changes).count(value)==0 or (newNode->changes)[value]>leftNonZeroMin[value]+rightZero[value] )
-					{
-						(newNode->changes)[value]=leftNonZeroMin[value]+rightZero[value];
-						(newNode->leftV)[value]=leftNonZeroNode[value];
-						(newNode->rightV)[value]=0LL;
-					}
-				}
+				long long value=changedKeys[i];
+				NodeLabel label={value, changes[value], leftV[value], rightV[value]};
+				(newNode->labels).push_back(label);
+				changes[value]=MAXINT;
 			}
+			changedKeys.clear();
 //			cout<<"Zero done"<<endl;
 
 			///////////////////
@@ -346,12 +351,13 @@ NodeCentric(vector<string> input)
 	int minSub=MAXINT;
 	long long label=-1;
 
-	for(map<long long, int>::iterator i=(stack[0]->changes).begin(); i!=(stack[0]->changes).end(); i++)
+	const vector<NodeLabel>& rootLabels=stack[0]->labels;
+	for(size_t i=0; i<rootLabels.size(); i++)
 	{
-		if(i->second < minSub)
+		if(rootLabels[i].changes < minSub)
 		{
-			minSub=i->second;
-			label=i->first;
+			minSub=rootLabels[i].changes;
+			label=rootLabels[i].value;
 		}
 	}
 //	cout<<minSub;
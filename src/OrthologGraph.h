@@ -0,0 +1,423 @@
+#ifndef ORTHOLOGGRAPH_H
+#define ORTHOLOGGRAPH_H
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "GeneDictionary.h"
+#include "PairFileParser.h"
+#include "ThreadPool.h"
+
+/**
+ * OrthologGraph - Immutable CSR adjacency of the ortholog graph
+ *
+ * Row g lists the distinct neighbors of gene g in ascending id order, so a
+ * pair read twice is one edge. Every undirected edge is stored once: its
+ * score sits with the row of its smaller gene, whose entries from g on
+ * (the upper part of the row) index straight into the edge arrays. The
+ * score of an edge is that of the last loaded line joining its genes. The
+ * arrays are either owned or borrowed from a mapped graph cache, which
+ * must then outlive the graph.
+ */
+class OrthologGraph {
+private:
+    std::vector<uint64_t> ownedOffsets;
+    std::vector<uint64_t> ownedEdgeOffsets;
+    std::vector<GeneId> ownedNeighbors;
+    std::vector<double> ownedWeights;
+
+    const uint64_t* rowOffsets;
+    const uint64_t* rowEdges;
+    const GeneId* neighborIds;
+    const double* edgeWeights;
+    size_t geneCount;
+
+public:
+    OrthologGraph()
+        : rowOffsets(nullptr), rowEdges(nullptr), neighborIds(nullptr), edgeWeights(nullptr),
+          geneCount(0)
+    {}
+
+    OrthologGraph(const OrthologGraph&) = delete;
+    OrthologGraph& operator=(const OrthologGraph&) = delete;
+
+    /**
+     * Take ownership of freshly built arrays (the vectors are emptied)
+     * @param offsets Row starts in neighbors, geneCount+1 entries
+     * @param edgeOffsets Start of each row's upper part in weights,
+     *                    geneCount+1 entries
+     */
+    void assign(std::vector<uint64_t>& offsets, std::vector<uint64_t>& edgeOffsets,
+                std::vector<GeneId>& neighbors, std::vector<double>& weights)
+    {
+        ownedOffsets.swap(offsets);
+        ownedEdgeOffsets.swap(edgeOffsets);
+        ownedNeighbors.swap(neighbors);
+        ownedWeights.swap(weights);
+        borrow(ownedOffsets.data(), ownedEdgeOffsets.data(), ownedNeighbors.data(),
+               ownedWeights.data(), ownedOffsets.size() - 1);
+    }
+
+    /**
+     * Point at arrays owned by someone else, e.g. a mapped .mmsg file
+     */
+    void borrow(const uint64_t* offsets, const uint64_t* edgeOffsets, const GeneId* neighbors,
+                const double* weights, size_t genes)
+    {
+        rowOffsets = offsets;
+        rowEdges = edgeOffsets;
+        neighborIds = neighbors;
+        edgeWeights = weights;
+        geneCount = genes;
+    }
+
+    size_t size() const { return geneCount; }
+    uint64_t halfEdgeCount() const { return geneCount > 0 ? rowOffsets[geneCount] : 0; }
+    uint64_t edgeCount() const { return geneCount > 0 ? rowEdges[geneCount] : 0; }
+
+    const uint64_t* offsets() const { return rowOffsets; }
+    const uint64_t* edgeOffsets() const { return rowEdges; }
+    const GeneId* neighbors() const { return neighborIds; }
+    const double* weights() const { return edgeWeights; }
+
+    const GeneId* begin(GeneId g) const { return neighborIds + rowOffsets[g]; }
+    const GeneId* end(GeneId g) const { return neighborIds + rowOffsets[g + 1]; }
+
+    /**
+     * Upper part of row g: its neighbors >= g, up to end(g), and their
+     * scores in the same order
+     */
+    const GeneId* upperBegin(GeneId g) const {
+        return neighborIds + rowOffsets[g + 1] - (rowEdges[g + 1] - rowEdges[g]);
+    }
+    const double* upperWeights(GeneId g) const { return edgeWeights + rowEdges[g]; }
+
+    /**
+     * Score of the edge a-b: the last loaded line that joined the two genes
+     * wins, as it did when edges were kept in a map
+     * @return false if the genes are not adjacent
+     */
+    bool findWeight(GeneId a, GeneId b, double& weight) const {
+        if (b < a) std::swap(a, b);
+        // The upper part of row a holds its neighbors >= a, one per edge
+        const GeneId* upper = upperBegin(a);
+        const GeneId* last = end(a);
+        const GeneId* at = std::lower_bound(upper, last, b);
+        if (at == last || *at != b) return false;
+        weight = upperWeights(a)[at - upper];
+        return true;
+    }
+};
+
+namespace graphbuild {
+
+// Gene names are interned in this many independent shards, and the CSR
+// rows are filled in this many independent id ranges
+const size_t SHARDS = 64;
+
+inline size_t shardOf(const GeneView& v) {
+    return (size_t)(hashGeneName(v.data, v.length) >> 58);
+}
+
+// Half-open id range [rangeBegin(r), rangeBegin(r+1)) owned by range r
+inline GeneId rangeBegin(size_t r, size_t geneCount) {
+    return (GeneId)(((uint64_t)geneCount * r + SHARDS - 1) / SHARDS);
+}
+
+inline size_t rangeOf(GeneId g, size_t geneCount) {
+    return (size_t)((uint64_t)g * SHARDS / geneCount);
+}
+
+} // namespace graphbuild
+
+/**
+ * GraphBuilder - Builds the dictionary and graph from parsed pair files
+ *
+ * Pairs are taken in merge order (file order, then chunk order), whatever
+ * order the chunks were parsed in. route() sends each gene occurrence of
+ * a chunk to the shard owning its name hash, as soon as the chunk is
+ * parsed. Every shard then interns its names in merge order, so the last
+ * file a gene appears in still decides its species, and sorts them; a
+ * k-way merge of the sorted shards gives the global name-ordered ids.
+ * Half-edges are finally routed to the id range of their source gene;
+ * each range counts its degrees, takes its slice of the CSR arrays from a
+ * prefix sum over ranges and scatters its rows in merge order. Each range
+ * then sorts its rows in place, keeping the last score of every neighbor,
+ * and the compacted ranges are copied into the final arrays. Only the
+ * shard merge and the two prefix sums are serial, and they are linear in
+ * the number of distinct genes, not pairs.
+ */
+class GraphBuilder {
+private:
+    struct Chunk {
+        PairChunk* chunk;
+        int i, j;
+        uint64_t input;    // Index of the pair file
+        const char* text;  // Start of the file's text
+    };
+
+    GeneDictionary& genes;
+    OrthologGraph& graph;
+
+    std::vector<Chunk> chunks;
+    std::vector<GeneDictionary> shardGenes;
+    std::vector<std::vector<GeneId> > shardIds;
+    std::vector<uint64_t> rangeStart;
+    std::vector<uint64_t> offsets;
+    std::vector<GeneId> neighbors;
+    std::vector<double> weights;
+    bool keepLines;
+    std::vector<uint64_t> lines;
+
+    // Compacted rows: entries and edges of each row, then, after the
+    // prefix sum, their starts in the final arrays
+    std::vector<uint64_t> rowOffsets;
+    std::vector<uint64_t> edgeOffsets;
+    std::vector<GeneId> rowNeighbors;
+    std::vector<double> edgeWeights;
+
+    // Occurrence 2p is gene1 of pair p of a chunk, 2p+1 its gene2
+    static const GeneView& occurrence(const PairChunk& chunk, uint32_t occ) {
+        const OrthologPair& pair = chunk.pairs[occ >> 1];
+        return (occ & 1) ? pair.gene2 : pair.gene1;
+    }
+
+    void collect(std::vector<IOTask>& tasks) {
+        for (size_t t = 0; t < tasks.size(); t++) {
+            for (size_t c = 0; c < tasks[t].chunks.size(); c++) {
+                if (tasks[t].chunks[c].pairs.empty()) continue;
+                Chunk chunk = { &tasks[t].chunks[c], tasks[t].i, tasks[t].j, t, tasks[t].text() };
+                chunks.push_back(chunk);
+            }
+        }
+        shardGenes.resize(graphbuild::SHARDS);
+        shardIds.resize(graphbuild::SHARDS);
+    }
+
+    // Intern shard s in merge order, then sort it by name
+    void internShard(size_t s) {
+        GeneDictionary& dict = shardGenes[s];
+        for (size_t k = 0; k < chunks.size(); k++) {
+            PairChunk& chunk = *chunks[k].chunk;
+            const std::vector<uint32_t>& occs = chunk.routed[s];
+            for (size_t n = 0; n < occs.size(); n++) {
+                const GeneView& v = occurrence(chunk, occs[n]);
+                GeneId id = dict.intern(v.data, v.length);
+                dict.setSpecies(id, (occs[n] & 1) ? chunks[k].j : chunks[k].i);
+                chunk.ids[occs[n]] = id;
+            }
+        }
+        shardIds[s] = dict.sortByName();
+    }
+
+    // Merge the sorted shards into the global dictionary
+    void mergeShards() {
+        std::vector<const GeneDictionary*> parts;
+        for (size_t s = 0; s < shardGenes.size(); s++) parts.push_back(&shardGenes[s]);
+        std::vector<std::vector<GeneId> > globalIds;
+        genes.mergeSorted(parts, globalIds);
+
+        // Compose: shard-local id -> sorted shard id -> global id
+        for (size_t s = 0; s < shardIds.size(); s++) {
+            std::vector<GeneId>& ids = shardIds[s];
+            for (size_t n = 0; n < ids.size(); n++) ids[n] = globalIds[s][ids[n]];
+        }
+        std::vector<GeneDictionary>().swap(shardGenes);
+    }
+
+    // Resolve the global ids of a slice of the chunks and route each
+    // half-edge to the id range of its source gene
+    void resolveChunks(size_t part) {
+        using namespace graphbuild;
+        const size_t G = genes.size();
+        size_t first = chunks.size() * part / SHARDS;
+        size_t last = chunks.size() * (part + 1) / SHARDS;
+        for (size_t k = first; k < last; k++) {
+            PairChunk& chunk = *chunks[k].chunk;
+            for (size_t r = 0; r < SHARDS; r++) chunk.routed[r].clear();
+            for (uint32_t occ = 0; occ < chunk.ids.size(); occ++) {
+                GeneId id = shardIds[chunk.shard[occ]][chunk.ids[occ]];
+                chunk.ids[occ] = id;
+                chunk.routed[rangeOf(id, G)].push_back(occ);
+            }
+            std::vector<uint8_t>().swap(chunk.shard);
+        }
+    }
+
+    // Prefix sum over ranges; allocate the CSR arrays
+    void countRanges() {
+        using namespace graphbuild;
+        std::vector<std::vector<GeneId> >().swap(shardIds);
+        rangeStart.assign(SHARDS + 1, 0);
+        for (size_t r = 0; r < SHARDS; r++) {
+            uint64_t total = 0;
+            for (size_t k = 0; k < chunks.size(); k++) total += chunks[k].chunk->routed[r].size();
+            rangeStart[r + 1] = rangeStart[r] + total;
+        }
+        offsets.assign(genes.size() + 1, rangeStart[SHARDS]);
+        neighbors.resize(rangeStart[SHARDS]);
+        weights.resize(rangeStart[SHARDS]);
+        if (keepLines) lines.resize(rangeStart[SHARDS]);
+        else {
+            rowOffsets.assign(genes.size() + 1, 0);
+            edgeOffsets.assign(genes.size() + 1, 0);
+        }
+    }
+
+    // Count the degrees of range r and scatter its rows in merge order
+    void fillRange(size_t r) {
+        using namespace graphbuild;
+        GeneId lo = rangeBegin(r, genes.size()), hi = rangeBegin(r + 1, genes.size());
+        std::vector<uint64_t> fill(hi - lo, 0);
+        for (size_t k = 0; k < chunks.size(); k++) {
+            const PairChunk& chunk = *chunks[k].chunk;
+            const std::vector<uint32_t>& edges = chunk.routed[r];
+            for (size_t n = 0; n < edges.size(); n++) fill[chunk.ids[edges[n]] - lo]++;
+        }
+
+        uint64_t at = rangeStart[r];
+        for (GeneId g = lo; g < hi; g++) {
+            offsets[g] = at;
+            at += fill[g - lo];
+            fill[g - lo] = offsets[g];
+        }
+
+        for (size_t k = 0; k < chunks.size(); k++) {
+            const PairChunk& chunk = *chunks[k].chunk;
+            const std::vector<uint32_t>& edges = chunk.routed[r];
+            for (size_t n = 0; n < edges.size(); n++) {
+                uint32_t occ = edges[n];
+                uint64_t slot = fill[chunk.ids[occ] - lo]++;
+                neighbors[slot] = chunk.ids[occ ^ 1];
+                weights[slot] = chunk.pairs[occ >> 1].score;
+                if (keepLines) {
+                    uint64_t offset = (uint64_t)(chunk.pairs[occ >> 1].gene1.data - chunks[k].text);
+                    lines[slot] = (chunks[k].input << 48) | offset;
+                }
+            }
+        }
+    }
+
+    // Sort the rows of range r by neighbor, drop repeated neighbors but
+    // for the last loaded one, and pack the rows to the start of the
+    // range's slice: neighbors first, then the scores of the upper parts
+    void compactRange(size_t r) {
+        using namespace graphbuild;
+        GeneId lo = rangeBegin(r, genes.size()), hi = rangeBegin(r + 1, genes.size());
+        uint64_t neighborAt = rangeStart[r], weightAt = rangeStart[r];
+        std::vector<std::pair<uint64_t, double> > row;
+        for (GeneId g = lo; g < hi; g++) {
+            // (neighbor, load position): the last of a run is the last loaded
+            row.clear();
+            for (uint64_t k = offsets[g]; k < offsets[g + 1]; k++)
+                row.push_back(std::make_pair(((uint64_t)neighbors[k] << 32) | (k - offsets[g]), weights[k]));
+            std::sort(row.begin(), row.end());
+
+            uint64_t rowStart = neighborAt, edgeStart = weightAt;
+            for (size_t n = 0; n < row.size(); n++) {
+                GeneId v = (GeneId)(row[n].first >> 32);
+                if (n + 1 < row.size() && (GeneId)(row[n + 1].first >> 32) == v) continue;
+                neighbors[neighborAt++] = v;
+                if (v >= g) weights[weightAt++] = row[n].second;
+            }
+            rowOffsets[g] = neighborAt - rowStart;
+            edgeOffsets[g] = weightAt - edgeStart;
+        }
+    }
+
+    // Prefix sums of the compacted rows; allocate the final arrays
+    void countEdges() {
+        uint64_t entries = 0, edges = 0;
+        for (GeneId g = 0; g < genes.size(); g++) {
+            uint64_t n = rowOffsets[g], e = edgeOffsets[g];
+            rowOffsets[g] = entries;
+            edgeOffsets[g] = edges;
+            entries += n;
+            edges += e;
+        }
+        rowOffsets[genes.size()] = entries;
+        edgeOffsets[genes.size()] = edges;
+        rowNeighbors.resize(entries);
+        edgeWeights.resize(edges);
+    }
+
+    // Copy the compacted rows of range r into place
+    void placeRange(size_t r) {
+        using namespace graphbuild;
+        GeneId lo = rangeBegin(r, genes.size()), hi = rangeBegin(r + 1, genes.size());
+        std::copy(neighbors.begin() + rangeStart[r],
+                  neighbors.begin() + rangeStart[r] + (rowOffsets[hi] - rowOffsets[lo]),
+                  rowNeighbors.begin() + rowOffsets[lo]);
+        std::copy(weights.begin() + rangeStart[r],
+                  weights.begin() + rangeStart[r] + (edgeOffsets[hi] - edgeOffsets[lo]),
+                  edgeWeights.begin() + edgeOffsets[lo]);
+    }
+
+    void finish() {
+        chunks.clear();
+        if (keepLines) return;
+        std::vector<uint64_t>().swap(offsets);
+        std::vector<GeneId>().swap(neighbors);
+        std::vector<double>().swap(weights);
+        graph.assign(rowOffsets, edgeOffsets, rowNeighbors, edgeWeights);
+    }
+
+public:
+    GraphBuilder(GeneDictionary& g, OrthologGraph& og) : genes(g), graph(og), keepLines(false) {}
+
+    /**
+     * Build only the load-ordered rows, one entry per line and gene, and
+     * record where every entry's line is: (file index << 48) | offset of
+     * the line's first field in the file's text. The graph is left empty.
+     */
+    void recordLines() { keepLines = true; }
+    const std::vector<uint64_t>& postingOffsets() const { return offsets; }
+    const std::vector<GeneId>& postingNeighbors() const { return neighbors; }
+    const std::vector<uint64_t>& linePositions() const { return lines; }
+
+    /**
+     * Route the gene occurrences of a freshly parsed chunk to their shards;
+     * chunks may be routed concurrently and in any order
+     */
+    static void route(PairChunk& chunk) {
+        using namespace graphbuild;
+        uint32_t occurrences = (uint32_t)(2 * chunk.pairs.size());
+        chunk.shard.resize(occurrences);
+        chunk.ids.resize(occurrences);
+        chunk.routed.assign(SHARDS, std::vector<uint32_t>());
+        for (uint32_t occ = 0; occ < occurrences; occ++) {
+            size_t s = shardOf(occurrence(chunk, occ));
+            chunk.shard[occ] = (uint8_t)s;
+            chunk.routed[s].push_back(occ);
+        }
+    }
+
+    /**
+     * Add the build stages to a task graph
+     * @param tasks Pair files whose chunks are all parsed and routed once
+     *              node after has finished
+     * @return Node after which the dictionary and graph are filled in
+     */
+    size_t schedule(TaskGraph& stages, std::vector<IOTask>& tasks, size_t after) {
+        using namespace graphbuild;
+        size_t collected = stages.add([this, &tasks]() { collect(tasks); }, std::vector<size_t>(1, after));
+        size_t interned = stages.addRange(SHARDS, [this](size_t s) { internShard(s); },
+                                          std::vector<size_t>(1, collected));
+        size_t merged = stages.add([this]() { mergeShards(); }, std::vector<size_t>(1, interned));
+        size_t resolved = stages.addRange(SHARDS, [this](size_t p) { resolveChunks(p); },
+                                          std::vector<size_t>(1, merged));
+        size_t counted = stages.add([this]() { countRanges(); }, std::vector<size_t>(1, resolved));
+        size_t filled = stages.addRange(SHARDS, [this](size_t r) { fillRange(r); },
+                                        std::vector<size_t>(1, counted));
+        if (keepLines) return stages.add([this]() { finish(); }, std::vector<size_t>(1, filled));
+
+        size_t compacted = stages.addRange(SHARDS, [this](size_t r) { compactRange(r); },
+                                           std::vector<size_t>(1, filled));
+        size_t summed = stages.add([this]() { countEdges(); }, std::vector<size_t>(1, compacted));
+        size_t placed = stages.addRange(SHARDS, [this](size_t r) { placeRange(r); },
+                                        std::vector<size_t>(1, summed));
+        return stages.add([this]() { finish(); }, std::vector<size_t>(1, placed));
+    }
+};
+
+#endif // ORTHOLOGGRAPH_H
@@ -0,0 +1,230 @@
+#ifndef PAIRFILEPARSER_H
+#define PAIRFILEPARSER_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <stdint.h>
+#include <unistd.h>
+
+/**
+ * GeneView - Non-owning view of a gene name inside a mapped input buffer
+ *
+ * Valid only as long as the buffer it points into (see MappedFile)
+ */
+struct GeneView {
+    const char* data;
+    uint32_t length;
+
+    GeneView() : data(nullptr), length(0) {}
+    GeneView(const char* d, uint32_t n) : data(d), length(n) {}
+
+    bool empty() const { return length == 0; }
+    std::string str() const { return std::string(data, length); }
+
+    bool operator==(const GeneView& other) const {
+        return length == other.length && std::memcmp(data, other.data, length) == 0;
+    }
+};
+
+/**
+ * OrthologPair - One parsed line of an Si_Sj file: gene of Si, gene of Sj, score
+ */
+struct OrthologPair {
+    GeneView gene1;
+    GeneView gene2;
+    double score;
+};
+
+inline std::string pairFileName(int i, int j) {
+    std::stringstream ss;
+    ss << "S" << i << "_S" << j;
+    return ss.str();
+}
+
+/**
+ * Path of the Si_Sj input: the plain file if present, else its
+ * compressed "Si_Sj.gz" companion (BGZF or plain gzip)
+ */
+inline std::string resolvePairFile(int i, int j) {
+    std::string name = pairFileName(i, j);
+    if (access(name.c_str(), F_OK) != 0 && access((name + ".gz").c_str(), F_OK) == 0)
+        return name + ".gz";
+    return name;
+}
+
+namespace pairparser {
+
+inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool isDigit(char c) {
+    return (unsigned)(c - '0') < 10u;
+}
+
+// Slow path for anything the fast path cannot round exactly (long mantissas,
+// large exponents, inf/nan spellings): copy the token and defer to strtod
+inline double parseScoreFallback(const char* p, const char* end) {
+    char buf[128];
+    size_t n = (size_t)(end - p);
+    if (n >= sizeof(buf)) n = sizeof(buf) - 1;
+    std::memcpy(buf, p, n);
+    buf[n] = '\0';
+    char* stop = nullptr;
+    double v = std::strtod(buf, &stop);
+    return stop == buf ? 0.0 : v;
+}
+
+/**
+ * Parse a decimal score token [p, end)
+ *
+ * Decimal mantissas of up to 15 significant digits with a power-of-ten
+ * scale of at most 22 are converted exactly with one multiply or divide;
+ * everything else falls back to strtod. Like operator>>, a token without
+ * a leading number yields 0.
+ */
+inline double parseScore(const char* p, const char* end) {
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int scale = 0;
+    bool any = false;
+
+    while (p < end && isDigit(*p)) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa != 0) digits++;
+        } else {
+            scale++;
+        }
+        any = true;
+        ++p;
+    }
+    if (p < end && *p == '.') {
+        ++p;
+        while (p < end && isDigit(*p)) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa != 0) digits++;
+                scale--;
+            }
+            any = true;
+            ++p;
+        }
+    }
+    if (!any) return parseScoreFallback(start, end);
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool expNegative = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            expNegative = (*q == '-');
+            ++q;
+        }
+        if (q < end && isDigit(*q)) {
+            int exponent = 0;
+            while (q < end && isDigit(*q)) {
+                if (exponent < 10000) exponent = exponent * 10 + (*q - '0');
+                ++q;
+            }
+            scale += expNegative ? -exponent : exponent;
+        }
+    }
+
+    if (digits > 15 || scale < -22 || scale > 22) {
+        return parseScoreFallback(start, end);
+    }
+
+    double value = (double)mantissa;
+    if (scale < 0) value /= pow10[-scale];
+    else value *= pow10[scale];
+    return negative ? -value : value;
+}
+
+/**
+ * Parse every "gene1 gene2 score" line in [begin, end)
+ *
+ * Fields are separated by spaces or tabs. Lines with fewer than two fields
+ * are skipped; a missing score reads as 0. Gene names are returned as views
+ * into the input buffer, so nothing is allocated per line.
+ *
+ * @return Number of lines scanned
+ */
+inline size_t parseOrthologPairs(const char* begin, const char* end,
+                                 std::vector<OrthologPair>& out)
+{
+    size_t lines = 0;
+    const char* p = begin;
+
+    while (p < end) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', (size_t)(end - p)));
+        if (eol == nullptr) eol = end;
+        lines++;
+
+        const char* tok[3];
+        const char* tokEnd[3];
+        int n = 0;
+        const char* q = p;
+        while (n < 3) {
+            while (q < eol && isBlank(*q)) ++q;
+            if (q == eol) break;
+            tok[n] = q;
+            while (q < eol && !isBlank(*q)) ++q;
+            tokEnd[n] = q;
+            n++;
+        }
+
+        if (n >= 2) {
+            OrthologPair pair;
+            pair.gene1 = GeneView(tok[0], (uint32_t)(tokEnd[0] - tok[0]));
+            pair.gene2 = GeneView(tok[1], (uint32_t)(tokEnd[1] - tok[1]));
+            pair.score = (n == 3) ? parseScore(tok[2], tokEnd[2]) : 0.0;
+            out.push_back(pair);
+        }
+
+        p = eol + 1;
+    }
+    return lines;
+}
+
+/**
+ * Split [0, size) into byte ranges of roughly chunkBytes that end on line
+ * boundaries, so each range can be parsed independently
+ */
+inline std::vector<std::pair<size_t, size_t> > splitAtLines(const char* data, size_t size,
+                                                           size_t chunkBytes)
+{
+    std::vector<std::pair<size_t, size_t> > ranges;
+    size_t begin = 0;
+    while (begin < size) {
+        size_t end = begin + chunkBytes;
+        if (end >= size) {
+            end = size;
+        } else {
+            const void* eol = std::memchr(data + end, '\n', size - end);
+            end = eol ? (size_t)(static_cast<const char*>(eol) - data) + 1 : size;
+        }
+        ranges.push_back(std::make_pair(begin, end));
+        begin = end;
+    }
+    return ranges;
+}
+
+} // namespace pairparser
+
+#endif // PAIRFILEPARSER_H
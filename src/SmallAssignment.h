@@ -0,0 +1,193 @@
+#ifndef SMALLASSIGNMENT_H
+#define SMALLASSIGNMENT_H
+
+#include <climits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace smallassignment {
+
+// Largest column count solved by the fixed-size kernels; from 7 columns
+// on, the 2^C subsets cost more than the shortest-path solver
+const int MAX_COLUMNS = 6;
+
+/**
+ * Maximum weight assignment of rows <= C rows to distinct columns of a
+ * row-major rows x C matrix, by dynamic programming over column subsets:
+ * best[mask] is the best weight of giving the first popcount(mask) rows
+ * the columns in mask. At most C*2^(C-1) steps, with selects instead of
+ * branches, all on the stack. Ties go to the lowest column, then the
+ * lowest final subset.
+ * @return Total weight; row i gets column matchingX[i]
+ */
+template<int C>
+inline int assign(const int* w, int rows, int* matchingX)
+{
+    int best[1 << C];
+    signed char last[1 << C];
+    best[0] = 0;
+    int total = INT_MIN;
+    unsigned totalMask = 0;
+    for (unsigned mask = 1; mask < (1u << C); mask++) {
+        int k = __builtin_popcount(mask);
+        if (k > rows) continue;
+        const int* row = w + (k - 1) * C;
+        int b = INT_MIN, at = 0;
+        for (unsigned bits = mask; bits; bits &= bits - 1) {
+            int j = __builtin_ctz(bits);
+            int v = best[mask ^ (1u << j)] + row[j];
+            bool better = v > b;
+            b = better ? v : b;
+            at = better ? j : at;
+        }
+        best[mask] = b;
+        last[mask] = (signed char)at;
+        bool better = k == rows && b > total;
+        total = better ? b : total;
+        totalMask = better ? mask : totalMask;
+    }
+    for (int k = rows; k > 0; k--) {
+        matchingX[k - 1] = last[totalMask];
+        totalMask ^= 1u << last[totalMask];
+    }
+    return total;
+}
+
+/**
+ * Dispatch on the column count
+ * @param w Row-major rows x cols matrix, 1 <= rows <= cols <= MAX_COLUMNS
+ */
+inline int assign(const int* w, int rows, int cols, int* matchingX)
+{
+    switch (cols) {
+    case 1: return assign<1>(w, rows, matchingX);
+    case 2: return assign<2>(w, rows, matchingX);
+    case 3: return assign<3>(w, rows, matchingX);
+    case 4: return assign<4>(w, rows, matchingX);
+    case 5: return assign<5>(w, rows, matchingX);
+    default: return assign<6>(w, rows, matchingX);
+    }
+}
+
+// Problems of one shape solved together by assignBatch, one per 32-bit
+// lane of an AVX2 register
+const int LANES = 8;
+
+/**
+ * Solve LANES problems of the same shape at once, running the subset DP
+ * of assign<C> lane by lane. The matrices are interleaved: entry (r, c)
+ * of lane l is w[(r*C + c)*LANES + l]. Every lane gets the matching
+ * assign<C> would give it, ties included.
+ * @param matchingX Receives the column of row r of lane l at
+ *                  matchingX[r*LANES + l]
+ */
+template<int C>
+inline void assignBatch(const int* w, int rows, int* matchingX)
+{
+#ifdef __AVX2__
+    // best and last hold one vector per subset; they are only ever
+    // touched as whole vectors, and the traceback gathers its lanes
+    __m256i best[1 << C], last[1 << C];
+    const __m256i lowest = _mm256_set1_epi32(INT_MIN);
+    best[0] = _mm256_setzero_si256();
+    last[0] = _mm256_setzero_si256();
+    __m256i total = lowest, totalAt = _mm256_setzero_si256();
+    for (unsigned mask = 1; mask < (1u << C); mask++) {
+        int k = __builtin_popcount(mask);
+        if (k > rows) continue;
+        const int* row = w + (k - 1) * C * LANES;
+        __m256i b = lowest, at = _mm256_setzero_si256();
+        for (unsigned bits = mask; bits; bits &= bits - 1) {
+            int j = __builtin_ctz(bits);
+            __m256i v = _mm256_add_epi32(best[mask ^ (1u << j)],
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + j * LANES)));
+            __m256i better = _mm256_cmpgt_epi32(v, b);
+            b = _mm256_blendv_epi8(b, v, better);
+            at = _mm256_blendv_epi8(at, _mm256_set1_epi32(j), better);
+        }
+        best[mask] = b;
+        last[mask] = at;
+        if (k == rows) {
+            __m256i better = _mm256_cmpgt_epi32(b, total);
+            total = _mm256_blendv_epi8(total, b, better);
+            totalAt = _mm256_blendv_epi8(totalAt, _mm256_set1_epi32((int)mask), better);
+        }
+    }
+    // Lane l of subset mask is int number mask*LANES + l of last
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i one = _mm256_set1_epi32(1);
+    __m256i mask = totalAt;
+    for (int k = rows; k > 0; k--) {
+        __m256i j = _mm256_i32gather_epi32(reinterpret_cast<const int*>(last),
+            _mm256_add_epi32(_mm256_slli_epi32(mask, 3), lane), 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(matchingX + (k - 1) * LANES), j);
+        mask = _mm256_xor_si256(mask, _mm256_sllv_epi32(one, j));
+    }
+#else
+    int best[(1 << C) * LANES];
+    int last[(1 << C) * LANES];
+    int total[LANES], totalMask[LANES];
+    for (int l = 0; l < LANES; l++) {
+        best[l] = 0;
+        total[l] = INT_MIN;
+        totalMask[l] = 0;
+    }
+    for (unsigned mask = 1; mask < (1u << C); mask++) {
+        int k = __builtin_popcount(mask);
+        if (k > rows) continue;
+        const int* row = w + (k - 1) * C * LANES;
+        int* b = best + mask * LANES;
+        int* at = last + mask * LANES;
+        for (int l = 0; l < LANES; l++) {
+            b[l] = INT_MIN;
+            at[l] = 0;
+        }
+        for (unsigned bits = mask; bits; bits &= bits - 1) {
+            int j = __builtin_ctz(bits);
+            const int* from = best + (mask ^ (1u << j)) * LANES;
+            for (int l = 0; l < LANES; l++) {
+                int v = from[l] + row[j * LANES + l];
+                bool better = v > b[l];
+                b[l] = better ? v : b[l];
+                at[l] = better ? j : at[l];
+            }
+        }
+        if (k != rows) continue;
+        for (int l = 0; l < LANES; l++) {
+            bool better = b[l] > total[l];
+            total[l] = better ? b[l] : total[l];
+            totalMask[l] = better ? (int)mask : totalMask[l];
+        }
+    }
+    for (int l = 0; l < LANES; l++) {
+        unsigned mask = (unsigned)totalMask[l];
+        for (int k = rows; k > 0; k--) {
+            int j = last[mask * LANES + l];
+            matchingX[(k - 1) * LANES + l] = j;
+            mask ^= 1u << j;
+        }
+    }
+#endif
+}
+
+/**
+ * Dispatch on the column count
+ * @param w Interleaved matrices of LANES rows x cols problems,
+ *          1 <= rows <= cols <= MAX_COLUMNS
+ */
+inline void assignBatch(const int* w, int rows, int cols, int* matchingX)
+{
+    switch (cols) {
+    case 1: assignBatch<1>(w, rows, matchingX); break;
+    case 2: assignBatch<2>(w, rows, matchingX); break;
+    case 3: assignBatch<3>(w, rows, matchingX); break;
+    case 4: assignBatch<4>(w, rows, matchingX); break;
+    case 5: assignBatch<5>(w, rows, matchingX); break;
+    default: assignBatch<6>(w, rows, matchingX); break;
+    }
+}
+
+} // namespace smallassignment
+
+#endif // SMALLASSIGNMENT_H
@@ -0,0 +1,189 @@
+#ifndef SPARSEASSIGNMENT_H
+#define SPARSEASSIGNMENT_H
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <stdint.h>
+
+/**
+ * SparseEntry - Non-zero entry of a sparse score matrix
+ */
+struct SparseEntry {
+    int row, col;
+    int weight;
+
+    bool operator<(const SparseEntry& o) const {
+        return row != o.row ? row < o.row : col < o.col;
+    }
+};
+
+/**
+ * SparseAssignment - Maximum weight assignment of a mostly-zero matrix
+ *
+ * Every row of a rows x cols matrix (rows <= cols) gets a distinct column,
+ * as Hungarian does, but only the positive entries are stored and
+ * searched. With no negative scores an optimal assignment is a maximum
+ * weight matching over the positive entries, completed with zero-weight
+ * pairs; the matching is found by a forward auction with epsilon scaling.
+ *
+ * The auction runs on a square problem with a perfect assignment: the
+ * rows and columns that have an entry are the persons and objects, each
+ * row may also take a dummy object of its own (left unmatched), and each
+ * column has a dummy person that takes it or the dummy object of one of
+ * its rows. Benefits are scaled by n+1, so the last phase, at epsilon 1,
+ * is optimal for the integer weights.
+ *
+ * A solver keeps its arrays between problems, so one per worker solves
+ * problem after problem without allocating once they have grown.
+ */
+class SparseAssignment {
+private:
+    // Arcs of every person, in CSR form
+    std::vector<uint32_t> arcStart;
+    std::vector<int> arcObject;
+    std::vector<int64_t> arcBenefit;
+
+    std::vector<int64_t> price;
+    std::vector<int> owner;   // Person holding each object, or -1
+    std::vector<int> holds;   // Object held by each person, or -1
+    std::vector<int> queue;
+
+    std::vector<int> rowPerson, personRow;
+    std::vector<int> colObject, objectCol;
+    std::vector<uint32_t> objectStart;  // Rows of each object, in CSR form
+    std::vector<int> objectRows;
+    std::vector<char> columnTaken;
+
+    void addArc(int object, int64_t benefit) {
+        arcObject.push_back(object);
+        arcBenefit.push_back(benefit);
+    }
+
+    // One auction phase: every person bids for its best object until all
+    // hold one, keeping the prices of the previous phase
+    void auction(int n, int64_t epsilon) {
+        owner.assign(n, -1);
+        holds.assign(n, -1);
+        queue.clear();
+        for (int i = 0; i < n; i++) queue.push_back(i);
+        for (size_t head = 0; head < queue.size(); head++) {
+            int i = queue[head];
+            int best = -1;
+            int64_t first = std::numeric_limits<int64_t>::min(), second = first;
+            for (uint32_t a = arcStart[i]; a < arcStart[i + 1]; a++) {
+                int64_t value = arcBenefit[a] - price[arcObject[a]];
+                if (value > first) {
+                    second = first;
+                    first = value;
+                    best = arcObject[a];
+                } else if (value > second) {
+                    second = value;
+                }
+            }
+            // Every person has at least two arcs
+            price[best] += first - second + epsilon;
+            if (owner[best] >= 0) {
+                holds[owner[best]] = -1;
+                queue.push_back(owner[best]);
+            }
+            owner[best] = i;
+            holds[i] = best;
+        }
+    }
+
+public:
+    /**
+     * Solve a rows x cols problem (rows <= cols)
+     * @param entries Positive entries, sorted by row then column, one per
+     *                position
+     * @param matchingX Receives the column of every row
+     * @return Total weight
+     */
+    int solve(int rows, int cols, const std::vector<SparseEntry>& entries, int* matchingX) {
+        std::fill(matchingX, matchingX + rows, -1);
+        columnTaken.assign(cols, 0);
+
+        // Persons: rows with an entry, then a dummy per column with one
+        rowPerson.assign(rows, -1);
+        colObject.assign(cols, -1);
+        personRow.clear();
+        objectCol.clear();
+        for (size_t e = 0; e < entries.size(); e++) {
+            if (rowPerson[entries[e].row] < 0) {
+                rowPerson[entries[e].row] = (int)personRow.size();
+                personRow.push_back(entries[e].row);
+            }
+        }
+        for (size_t e = 0; e < entries.size(); e++) colObject[entries[e].col] = 0;
+        for (int c = 0; c < cols; c++) {
+            if (colObject[c] < 0) continue;
+            colObject[c] = (int)objectCol.size();
+            objectCol.push_back(c);
+        }
+        const int r = (int)personRow.size(), c = (int)objectCol.size();
+        const int n = r + c;
+
+        int totalweight = 0;
+        if (n > 0) {
+            // Rows of every column, to give its dummy person their dummies
+            objectStart.assign(c + 1, 0);
+            for (size_t e = 0; e < entries.size(); e++) objectStart[colObject[entries[e].col] + 1]++;
+            for (int o = 0; o < c; o++) objectStart[o + 1] += objectStart[o];
+            objectRows.resize(entries.size());
+            for (size_t e = 0; e < entries.size(); e++)
+                objectRows[objectStart[colObject[entries[e].col]]++] = rowPerson[entries[e].row];
+            for (int o = c; o > 0; o--) objectStart[o] = objectStart[o - 1];
+            objectStart[0] = 0;
+
+            // Objects: the columns, then the dummy of each row
+            const int64_t scale = n + 1;
+            int64_t maxBenefit = 0;
+            arcStart.assign(1, 0);
+            arcObject.clear();
+            arcBenefit.clear();
+            size_t e = 0;
+            for (int i = 0; i < r; i++) {
+                for (; e < entries.size() && entries[e].row == personRow[i]; e++) {
+                    addArc(colObject[entries[e].col], entries[e].weight * scale);
+                    maxBenefit = std::max(maxBenefit, entries[e].weight * scale);
+                }
+                addArc(c + i, 0);
+                arcStart.push_back((uint32_t)arcObject.size());
+            }
+            for (int o = 0; o < c; o++) {
+                addArc(o, 0);
+                for (uint32_t k = objectStart[o]; k < objectStart[o + 1]; k++) addArc(c + objectRows[k], 0);
+                arcStart.push_back((uint32_t)arcObject.size());
+            }
+
+            price.assign(n, 0);
+            int64_t epsilon = std::max<int64_t>(1, maxBenefit / 4);
+            for (;;) {
+                auction(n, epsilon);
+                if (epsilon == 1) break;
+                epsilon = std::max<int64_t>(1, epsilon / 5);
+            }
+
+            for (int i = 0; i < r; i++) {
+                if (holds[i] >= c) continue;
+                int col = objectCol[holds[i]];
+                matchingX[personRow[i]] = col;
+                columnTaken[col] = 1;
+            }
+            for (size_t k = 0; k < entries.size(); k++)
+                if (matchingX[entries[k].row] == entries[k].col) totalweight += entries[k].weight;
+        }
+
+        // Complete with zero-weight pairs, in order
+        for (int row = 0, col = 0; row < rows; row++) {
+            if (matchingX[row] >= 0) continue;
+            while (columnTaken[col]) col++;
+            matchingX[row] = col;
+            columnTaken[col] = 1;
+        }
+        return totalweight;
+    }
+};
+
+#endif // SPARSEASSIGNMENT_H
@@ -3,12 +3,23 @@
 
 #include <vector>
 #include <queue>
+#include <deque>
+#include <exception>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <future>
+#include <chrono>
 #include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include "MappedFile.h"
+#include "PairFileParser.h"
+#include "GeneDictionary.h"
+
+class OrthologGraph;
 
 /**
  * ThreadPool - A C++11 thread pool implementation for parallel task execution
@@ -19,6 +30,7 @@
  * - Support for task futures and return values
  * - Graceful shutdown with task completion
  * - Thread-safe task submission
+ * - Subtasks that a running task can wait on while helping run them
  */
 class ThreadPool {
 private:
@@ -28,6 +40,9 @@ private:
     // Task queue
     std::queue<std::function<void()>> tasks;
 
+    // Subtasks spawned by running tasks; workers take these first
+    std::queue<std::function<void()>> subtasks;
+
     // Synchronization primitives
     std::mutex queue_mutex;
     std::condition_variable condition;
@@ -99,13 +114,56 @@ public:
         return result;
     }
 
+    /**
+     * Enqueue a subtask of the calling task; wait for it with
+     * helpUntilReady(), never by blocking on the future alone
+     * @return Future that will contain the result
+     */
+    template<class F>
+    auto enqueueSubtask(F&& f) -> std::future<typename std::result_of<F()>::type>
+    {
+        using return_type = typename std::result_of<F()>::type;
+
+        auto task = std::make_shared<std::packaged_task<return_type()>>(std::forward<F>(f));
+        std::future<return_type> result = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            if (stop) {
+                throw std::runtime_error("enqueue on stopped ThreadPool");
+            }
+            subtasks.emplace([task]() { (*task)(); });
+        }
+        condition.notify_all();
+        return result;
+    }
+
+    /**
+     * Run queued subtasks on the calling thread until a future is ready.
+     * Only subtasks are run, never whole tasks, so a task's own state is
+     * never re-entered. A pool of one thread still makes progress.
+     */
+    template<class T>
+    void helpUntilReady(std::future<T>& future) {
+        auto ready = [&future]() {
+            return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        };
+        while (!ready()) {
+            if (runSubtask()) continue;
+            // Woken when a subtask is queued or any task finishes; the
+            // timeout covers a completion signalled just before waiting
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            condition.wait_for(lock, std::chrono::milliseconds(1),
+                               [this, &ready] { return !subtasks.empty() || ready(); });
+        }
+    }
+
     /**
      * Wait for all tasks to complete
      */
     void wait() {
         std::unique_lock<std::mutex> lock(queue_mutex);
         condition.wait(lock, [this] {
-            return tasks.empty() && active_tasks == 0;
+            return tasks.empty() && subtasks.empty() && active_tasks == 0;
         });
     }
 
@@ -121,7 +179,7 @@ public:
      */
     size_t pending() {
         std::unique_lock<std::mutex> lock(queue_mutex);
-        return tasks.size();
+        return tasks.size() + subtasks.size();
     }
 
     /**
@@ -146,6 +204,25 @@ public:
     }
 
 private:
+    /**
+     * Run one queued subtask on the calling thread
+     * @return false if there was none
+     */
+    bool runSubtask() {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            if (subtasks.empty()) return false;
+            task = std::move(subtasks.front());
+            subtasks.pop();
+            active_tasks++;
+        }
+        task();
+        active_tasks--;
+        condition.notify_all();
+        return true;
+    }
+
     /**
      * Worker thread function - processes tasks from the queue
      */
@@ -158,16 +235,20 @@ private:
                 std::unique_lock<std::mutex> lock(queue_mutex);
 
                 condition.wait(lock, [this] {
-                    return stop || !tasks.empty();
+                    return stop || !tasks.empty() || !subtasks.empty();
                 });
 
                 // Exit if stopping and no tasks remain
-                if (stop && tasks.empty()) {
+                if (stop && tasks.empty() && subtasks.empty()) {
                     return;
                 }
 
-                // Get next task
-                if (!tasks.empty()) {
+                // Get next task, subtasks first
+                if (!subtasks.empty()) {
+                    task = std::move(subtasks.front());
+                    subtasks.pop();
+                    active_tasks++;
+                } else if (!tasks.empty()) {
                     task = std::move(tasks.front());
                     tasks.pop();
                     active_tasks++;
@@ -186,6 +267,147 @@ private:
     }
 };
 
+/**
+ * TaskGraph - Runs a small dependency graph of tasks on a ThreadPool
+ *
+ * Nodes are added with the nodes they depend on; after start(), each node
+ * is submitted as soon as its last dependency finishes, so independent
+ * stages overlap and no worker ever blocks waiting for another. A running
+ * node may add further nodes, and may make a node that still waits on it
+ * also wait on those (depend()). An exception thrown by a node is
+ * rethrown by wait().
+ */
+class TaskGraph {
+private:
+    struct Node {
+        std::function<void()> work;
+        std::vector<size_t> dependents;
+        size_t waiting;  // Unfinished dependencies
+        bool finished;
+    };
+
+    ThreadPool& pool;
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::deque<Node> nodes;
+    size_t unfinished;
+    bool started;
+    std::exception_ptr failure;
+
+    void submit(size_t id) {
+        pool.enqueue([this, id]() { run(id); });
+    }
+
+    void run(size_t id) {
+        std::function<void()> work;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            work.swap(nodes[id].work);
+        }
+
+        std::exception_ptr error;
+        try {
+            if (work) work();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        std::vector<size_t> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (error && !failure) failure = error;
+            nodes[id].finished = true;
+            for (size_t d : nodes[id].dependents) {
+                if (--nodes[d].waiting == 0) ready.push_back(d);
+            }
+            if (--unfinished == 0) idle.notify_all();
+        }
+        for (size_t d : ready) submit(d);
+    }
+
+public:
+    explicit TaskGraph(ThreadPool& p) : pool(p), unfinished(0), started(false) {}
+
+    /**
+     * Add a node
+     * @param work Task to run; may be empty for a pure join point
+     * @param deps Nodes that must finish first
+     * @return Id of the new node
+     */
+    size_t add(std::function<void()> work, const std::vector<size_t>& deps = std::vector<size_t>()) {
+        size_t id;
+        bool ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            id = nodes.size();
+            Node node;
+            node.work = std::move(work);
+            node.waiting = 0;
+            node.finished = false;
+            nodes.push_back(std::move(node));
+            unfinished++;
+            for (size_t d : deps) {
+                if (!nodes[d].finished) {
+                    nodes[d].dependents.push_back(id);
+                    nodes[id].waiting++;
+                }
+            }
+            ready = started && nodes[id].waiting == 0;
+        }
+        if (ready) submit(id);
+        return id;
+    }
+
+    /**
+     * Add n nodes running body(k), k in [0, n), plus a node joining them
+     * @return Id of the join node
+     */
+    template<class F>
+    size_t addRange(size_t n, F body, const std::vector<size_t>& deps = std::vector<size_t>()) {
+        std::vector<size_t> parts;
+        for (size_t k = 0; k < n; ++k) {
+            parts.push_back(add([body, k]() { body(k); }, deps));
+        }
+        return add(std::function<void()>(), parts);
+    }
+
+    /**
+     * Make node also wait for dep. Before start() any node qualifies;
+     * afterwards only a node that is still waiting on the caller.
+     */
+    void depend(size_t node, size_t dep) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!nodes[dep].finished) {
+            nodes[dep].dependents.push_back(node);
+            nodes[node].waiting++;
+        }
+    }
+
+    /**
+     * Submit every node whose dependencies are already met
+     */
+    void start() {
+        std::vector<size_t> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            started = true;
+            for (size_t id = 0; id < nodes.size(); id++) {
+                if (nodes[id].waiting == 0 && !nodes[id].finished) ready.push_back(id);
+            }
+        }
+        for (size_t id : ready) submit(id);
+    }
+
+    /**
+     * Block until every node has finished; call from outside the pool
+     */
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return unfinished == 0; });
+        if (failure) std::rethrow_exception(failure);
+    }
+};
+
 /**
  * ResultAggregator - Thread-safe accumulator for gene analysis results
  *
@@ -194,13 +416,13 @@ private:
 class ResultAggregator {
 private:
     std::mutex mutex;
-    std::set<std::string>& AllGeneBirth;
-    std::set<std::string>& AllGeneDuplication;
+    std::set<GeneId>& AllGeneBirth;
+    std::set<GeneId>& AllGeneDuplication;
     std::map<int, int>& AllGeneLoss;
 
 public:
-    ResultAggregator(std::set<std::string>& birth,
-                    std::set<std::string>& duplication,
+    ResultAggregator(std::set<GeneId>& birth,
+                    std::set<GeneId>& duplication,
                     std::map<int, int>& loss)
         : AllGeneBirth(birth), AllGeneDuplication(duplication), AllGeneLoss(loss)
     {}
@@ -209,8 +431,8 @@ public:
      * Aggregate results from a single family processing
      * Thread-safe: Uses mutex to protect shared data structures
      */
-    void aggregate(const std::set<std::string>& GeneBirth_local,
-                   const std::set<std::string>& GeneDuplication_local,
+    void aggregate(const std::set<GeneId>& GeneBirth_local,
+                   const std::set<GeneId>& GeneDuplication_local,
                    const std::map<int, int>& GeneLoss_local)
     {
         std::lock_guard<std::mutex> lock(mutex);
@@ -240,45 +462,82 @@ public:
 struct FamilyProcessingContext {
     // Input data
     int family_id;
-    std::set<std::string> genes;
+    const GeneId* genesBegin;  // Span of the family in its FamilyIndex
+    const GeneId* genesEnd;
 
     // Thread-local working variables (prevent race conditions)
-    std::map<std::string, int> visited_local;
-    std::vector<std::string> group_local;
+    std::unordered_set<GeneId> visited_local;
+    std::vector<GeneId> group_local;
 
     // Thread-local result accumulators
     std::vector<std::string> AllTrees_local;
-    std::vector<std::vector<std::string>> AllTreeGeneName_local;
-    std::set<std::string> GeneBirth_local;
-    std::set<std::string> GeneDuplication_local;
+    std::vector<std::vector<GeneId>> AllTreeGeneName_local;
+    std::set<GeneId> GeneBirth_local;
+    std::set<GeneId> GeneDuplication_local;
     std::map<int, int> GeneLoss_local;
 
     // Shared read-only data (safe to share)
     const std::string* speciesTree;
-    const std::map<std::string, int>* species;
-    const std::map<std::string, std::vector<std::string>>* adjacency;
-    const std::map<std::pair<std::string, std::string>, double>* edges;
+    const GeneDictionary* dictionary;
+    const OrthologGraph* graph;
     int S;
 
     FamilyProcessingContext()
-        : family_id(-1), speciesTree(nullptr), species(nullptr),
-          adjacency(nullptr), edges(nullptr), S(0)
+        : family_id(-1), genesBegin(nullptr), genesEnd(nullptr), speciesTree(nullptr), dictionary(nullptr),
+          graph(nullptr), S(0)
     {}
 };
 
+/**
+ * PairChunk - Pairs parsed from one newline-aligned range of a pair file
+ *
+ * The remaining fields are scratch space of the graph build (see
+ * GraphBuilder in OrthologGraph.h), which routes every gene occurrence of
+ * the chunk as soon as the chunk is parsed.
+ */
+struct PairChunk {
+    std::vector<OrthologPair> pairs;
+
+    std::vector<uint8_t> shard;                 // Name shard of every gene occurrence
+    std::vector<GeneId> ids;                    // Shard-local, then global, id of every occurrence
+    std::vector<std::vector<uint32_t>> routed;  // Occurrences per shard, then half-edges per id range
+};
+
 /**
  * IOTask - Contains data for parallel file I/O operations
+ *
+ * Large files are parsed as several newline-aligned byte ranges; each
+ * range fills its own entry of chunks, in file order. The gene names are
+ * views into the mapped file (or into the inflated text of a compressed input),
+ * so the task must outlive its pairs.
  */
 struct IOTask {
     int i, j;  // Species indices
     std::string filename;
 
-    // Thread-local results
-    std::vector<std::tuple<std::string, std::string, double>> ortholog_pairs;
+    // Mapping of the input file
+    MappedFile file;
+
+    // Inflated text when the input is BGZF or gzip compressed
+    std::unique_ptr<char[]> inflated;
+    size_t inflatedSize;
+
+    // Per-chunk results, in file order
+    std::vector<PairChunk> chunks;
 
     IOTask(int si, int sj, const std::string& fname)
-        : i(si), j(sj), filename(fname)
+        : i(si), j(sj), filename(fname), inflatedSize(0)
     {}
+
+    // Text to parse: the mapping itself, or the inflated copy
+    const char* text() const { return inflated ? inflated.get() : file.data(); }
+    size_t textSize() const { return inflated ? inflatedSize : file.size(); }
+
+    size_t pairCount() const {
+        size_t n = 0;
+        for (size_t c = 0; c < chunks.size(); c++) n += chunks[c].pairs.size();
+        return n;
+    }
 };
 
 #endif // THREADPOOL_H
@@ -5,6 +5,7 @@
 #include <vector>
 #include <iomanip>
 #include <set>
+#include "GeneDictionary.h"
 
 using namespace std;
 
@@ -21,9 +22,9 @@ class NODE
 class GeneInfo
 {
 	public:
-		string geneName;
+		GeneId geneName;
 		int nodeIndex;
-		GeneInfo(){geneName=""; nodeIndex=-1; }
+		GeneInfo(){geneName=NO_GENE; nodeIndex=-1; }
 };
 
 class TreeAnalysis
@@ -33,11 +34,11 @@ class TreeAnalysis
 		vector<string> Label;
 		string speciesTree;
 		vector<vector<int> > groups;
-		vector<vector<string> > geneName;
+		vector<vector<GeneId> > geneName;
 		int N, S;
 
-		vector<string> GeneBirth;
-		vector<string> GeneDuplication;
+		vector<GeneId> GeneBirth;
+		vector<GeneId> GeneDuplication;
 		vector<int> GeneLoss;
 
 		int groupIndex;
@@ -136,7 +137,7 @@ class TreeAnalysis
 		}
 
 		// Second Constructor
-		TreeAnalysis(string spt, vector<string> labeling, vector<vector<string> > treeGeneName)
+		TreeAnalysis(string spt, vector<string> labeling, vector<vector<GeneId> > treeGeneName)
 		{
 			speciesTree=spt;
 			Label=labeling;
@@ -147,7 +148,13 @@ class TreeAnalysis
 		}
 
 
-		void printAnalysis()
+		// Name of a gene; dummy slots (NO_GENE) print as ""
+		static string nameOf(GeneId g, const GeneDictionary& genes)
+		{
+			return g!=NO_GENE ? genes.name(g) : string();
+		}
+
+		void printAnalysis(const GeneDictionary& genes)
 		{
 			for(int i=0; i<N; i++)
 			{
@@ -158,15 +165,17 @@ class TreeAnalysis
 				{
 					cout<<"\tGroup "<<j<<": ";
 					for(int k=0; k<groups[j].size(); k++)
-						cout<<geneName[i][groups[j][k]]<<"\t";
+						cout<<nameOf(geneName[i][groups[j][k]], genes)<<"\t";
 					cout<<endl;
 				}
 			}
 		}
 
-		void printOrthoGroups(ofstream& outfile)
+		// Gene ids are numbered in name order, so sets of ids print in the
+		// same order as sets of names
+		void printOrthoGroups(ofstream& outfile, const GeneDictionary& genes)
 		{
-			set<set<string> > sst;
+			set<set<GeneId> > sst;
 
 			for(int i=0; i<N; i++)
 			{
@@ -174,28 +183,28 @@ class TreeAnalysis
 
 				for(int j=0; j<groups.size(); j++)
 				{
-					set<string> stmp;
+					set<GeneId> stmp;
 					for(int k=0; k<groups[j].size(); k++)
-						if(geneName[i][groups[j][k]]!="")
+						if(geneName[i][groups[j][k]]!=NO_GENE)
 							stmp.insert(geneName[i][groups[j][k]]);
 					sst.insert(stmp);
 				}
 			}
 
-			for(set<set<string> >::iterator it=sst.begin(); it!=sst.end(); it++)
+			for(set<set<GeneId> >::iterator it=sst.begin(); it!=sst.end(); it++)
 			{
 				if((*it).size()<2) continue;
-				for(set<string>::iterator j=(*it).begin(); j!=(*it).end(); j++)
-					outfile<<*j<<"\t";
+				for(set<GeneId>::iterator j=(*it).begin(); j!=(*it).end(); j++)
+					outfile<<genes.name(*j)<<"\t";
 				outfile<<endl;
 			}
 
 		}
 
 		// Thread-safe version: writes to stringstream buffer instead of file
-		void printOrthoGroups_Buffer(stringstream& buffer)
+		void printOrthoGroups_Buffer(stringstream& buffer, const GeneDictionary& genes)
 		{
-			set<set<string> > sst;
+			set<set<GeneId> > sst;
 
 			for(int i=0; i<N; i++)
 			{
@@ -203,25 +212,25 @@ class TreeAnalysis
 
 				for(int j=0; j<groups.size(); j++)
 				{
-					set<string> stmp;
+					set<GeneId> stmp;
 					for(int k=0; k<groups[j].size(); k++)
-						if(geneName[i][groups[j][k]]!="")
+						if(geneName[i][groups[j][k]]!=NO_GENE)
 							stmp.insert(geneName[i][groups[j][k]]);
 					sst.insert(stmp);
 				}
 			}
 
-			for(set<set<string> >::iterator it=sst.begin(); it!=sst.end(); it++)
+			for(set<set<GeneId> >::iterator it=sst.begin(); it!=sst.end(); it++)
 			{
 				if((*it).size()<2) continue;
-				for(set<string>::iterator j=(*it).begin(); j!=(*it).end(); j++)
-					buffer<<*j<<"\t";
+				for(set<GeneId>::iterator j=(*it).begin(); j!=(*it).end(); j++)
+					buffer.write(genes.nameData(*j), genes.nameLength(*j))<<"\t";
 				buffer<<endl;
 			}
 
 		}
 
-		void printDetailedAnalysis()
+		void printDetailedAnalysis(const GeneDictionary& genes)
 		{
 			for(int i=0; i<N; i++)
 			{
@@ -232,7 +241,7 @@ class TreeAnalysis
 				{
 					cout<<"\tGroup "<<j<<": ";
 					for(int k=0; k<groups[j].size(); k++)
-						cout<<geneName[i][groups[j][k]]<<"\t";
+						cout<<nameOf(geneName[i][groups[j][k]], genes)<<"\t";
 					cout<<endl;
 				}
 			}
@@ -296,11 +305,11 @@ class TreeAnalysis
 								{
 									if(unionTree[j]=='1')
 									{
-										cout<<geneName[i][left1]<<" is a duplicated gene."<<endl;
+										cout<<nameOf(geneName[i][left1], genes)<<" is a duplicated gene."<<endl;
 									}
 									else
 									{
-										cout<<geneName[i][left1]<<" is a new created gene."<<endl;
+										cout<<nameOf(geneName[i][left1], genes)<<" is a new created gene."<<endl;
 									}
 								}
 							}
@@ -319,11 +328,11 @@ class TreeAnalysis
 								{
 									if(unionTree[j]=='1')
 									{
-										cout<<geneName[i][right1]<<" is a duplicated gene."<<endl;
+										cout<<nameOf(geneName[i][right1], genes)<<" is a duplicated gene."<<endl;
 									}
 									else
 									{
-										cout<<geneName[i][right1]<<" is a new created gene."<<endl;
+										cout<<nameOf(geneName[i][right1], genes)<<" is a new created gene."<<endl;
 									}
 								}
 							}
@@ -388,12 +397,12 @@ class TreeAnalysis
 							{
 								if(unionTree[j]=='0')
 								{
-									if(right->geneName!="") GeneBirth.push_back(right->geneName);
+									if(right->geneName!=NO_GENE) GeneBirth.push_back(right->geneName);
 									unionTree[j]='1';
 								}
 								else
 								{
-									if(right->geneName!="")	GeneDuplication.push_back(right->geneName);
+									if(right->geneName!=NO_GENE)	GeneDuplication.push_back(right->geneName);
 								}
 							}
 							else
@@ -418,12 +427,12 @@ class TreeAnalysis
 							{
 								if(unionTree[j]=='0')
 								{
-									if(left->geneName!="") GeneBirth.push_back(left->geneName);
+									if(left->geneName!=NO_GENE) GeneBirth.push_back(left->geneName);
 									unionTree[j]='1';
 								}
 								else
 								{
-									if(left->geneName!="") GeneDuplication.push_back(left->geneName);
+									if(left->geneName!=NO_GENE) GeneDuplication.push_back(left->geneName);
 								}
 							}
 							else